@@ -0,0 +1,219 @@
+#include "chan.h"
+#include "image.h"
+#include <limits.h>
+
+/* Messages wait in a ring of cap entries. Senders block while it is
+   full, receivers while it is empty and still open */
+struct lchan {
+    volatile long refs;
+    th_mutex lock;
+    th_cond readable;
+    th_cond writable;
+    lpacked** ring;
+    int cap;
+    int head;
+    int count;
+    int closed;
+};
+
+static lchan* lchan_new(int cap) {
+    lchan* c = malloc(sizeof(lchan));
+    c->refs = 1;
+    th_mutex_init(&c->lock);
+    th_cond_init(&c->readable);
+    th_cond_init(&c->writable);
+    c->ring = malloc(sizeof(lpacked*) * cap);
+    c->cap = cap;
+    c->head = 0;
+    c->count = 0;
+    c->closed = 0;
+    return c;
+}
+
+void lchan_retain(lchan* c) {
+    th_atomic_add(&c->refs, 1);
+}
+
+void lchan_release(lchan* c) {
+    if (th_atomic_add(&c->refs, -1) > 0) { return; }
+    for (int i = 0; i < c->count; i++) {
+        lpacked_free(c->ring[(c->head + i) % c->cap]);
+    }
+    free(c->ring);
+    th_cond_destroy(&c->readable);
+    th_cond_destroy(&c->writable);
+    th_mutex_destroy(&c->lock);
+    free(c);
+}
+
+/* A new reference to c */
+lval* lval_chan(lchan* c) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_CHAN;
+    v->chan = c;
+    lchan_retain(c);
+    return v;
+}
+
+/* Queue a packed message, 0 if the channel is closed */
+static int chan_put(lchan* c, lpacked* m) {
+    th_mutex_lock(&c->lock);
+    while (c->count == c->cap && !c->closed) { th_cond_wait(&c->writable, &c->lock); }
+    int ok = !c->closed;
+    if (ok) {
+        c->ring[(c->head + c->count) % c->cap] = m;
+        c->count++;
+        th_cond_signal(&c->readable);
+    }
+    th_mutex_unlock(&c->lock);
+    return ok;
+}
+
+/* The oldest message, NULL once the channel is closed and drained */
+static lpacked* chan_take(lchan* c) {
+    th_mutex_lock(&c->lock);
+    while (c->count == 0 && !c->closed) { th_cond_wait(&c->readable, &c->lock); }
+    lpacked* m = NULL;
+    if (c->count) {
+        m = c->ring[c->head];
+        c->head = (c->head + 1) % c->cap;
+        c->count--;
+        th_cond_signal(&c->writable);
+    }
+    th_mutex_unlock(&c->lock);
+    return m;
+}
+
+static void chan_close(lchan* c) {
+    th_mutex_lock(&c->lock);
+    c->closed = 1;
+    th_cond_broadcast(&c->readable);
+    th_cond_broadcast(&c->writable);
+    th_mutex_unlock(&c->lock);
+}
+
+/* (make-chan capacity) */
+lval* builtin_make_chan(lenv* e, lval* a) {
+    LASSERT_NUM("make-chan", a, 1);
+    LASSERT_TYPE("make-chan", a, 0, LVAL_INUM);
+    LASSERT(a, a->cell[0]->inum > 0 && a->cell[0]->inum <= INT_MAX,
+        "Function 'make-chan' passed invalid capacity %lli.", a->cell[0]->inum);
+    int cap = (int)a->cell[0]->inum;
+    lval_del(a);
+    lchan* c = lchan_new(cap);
+    lval* v = lval_chan(c);
+    lchan_release(c);
+    return v;
+}
+
+/* (chan-send c x) - waits for room in c, then sends a copy of x */
+lval* builtin_chan_send(lenv* e, lval* a) {
+    LASSERT_NUM("chan-send", a, 2);
+    LASSERT_TYPE("chan-send", a, 0, LVAL_CHAN);
+
+    lpacked* m = image_pack(a->cell[1]);
+    if (!chan_put(a->cell[0]->chan, m)) {
+        lpacked_free(m);
+        lval_del(a);
+        return lval_err("Function 'chan-send' passed a closed channel.");
+    }
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* (chan-recv c) or (chan-recv c default) - waits for the next value of
+   c. Once c is closed and drained, returns default or an error */
+lval* builtin_chan_recv(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function 'chan-recv' passed incorrect number of arguments. "
+        "Got %i, Expected 1 or 2.", a->count);
+    LASSERT_TYPE("chan-recv", a, 0, LVAL_CHAN);
+
+    lpacked* m = chan_take(a->cell[0]->chan);
+    if (!m) {
+        if (a->count == 2) { return lval_take(a, 1); }
+        lval_del(a);
+        return lval_err("Channel closed");
+    }
+    lval* x = image_unpack(m);
+    lpacked_free(m);
+    lval_del(a);
+    return x;
+}
+
+/* (chan-close c) - ends c. Values already sent can still be received */
+lval* builtin_chan_close(lenv* e, lval* a) {
+    LASSERT_NUM("chan-close", a, 1);
+    LASSERT_TYPE("chan-close", a, 0, LVAL_CHAN);
+    chan_close(a->cell[0]->chan);
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* A spawned interpreter starts from an image of its parent's globals,
+   calls f on copies of the arguments, then sends the result to out */
+typedef struct {
+    lpacked* image;
+    lpacked* f;
+    lpacked* args;
+    lchan* out;
+    int cache;
+} lspawn;
+
+static void spawn_main(void* arg) {
+    lspawn* s = arg;
+    lctx = lctx_new();
+    lctx->cache = s->cache;
+
+    lval* x = image_restore(s->image);
+    if (x->type != LVAL_ERR) {
+        lval_del(x);
+        lval* f = image_unpack(s->f);
+        x = lval_call(lctx->rootenv, f, image_unpack(s->args));
+        lval_del(f);
+    }
+    lpacked* m = image_pack(x);
+    lval_del(x);
+    if (!chan_put(s->out, m)) { lpacked_free(m); }
+    chan_close(s->out);
+
+    lctx_del(lctx);
+    lpacked_free(s->image);
+    lpacked_free(s->f);
+    lpacked_free(s->args);
+    lchan_release(s->out);
+    free(s);
+}
+
+/* (spawn f args...) - calls f in a new interpreter on its own thread.
+   Returns a channel that receives the result */
+lval* builtin_spawn(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 1,
+        "Function 'spawn' passed incorrect number of arguments. "
+        "Got %i, Expected at least 1.", a->count);
+    LASSERT_TYPE("spawn", a, 0, LVAL_FUN);
+
+    lspawn* s = malloc(sizeof(lspawn));
+    s->image = image_snapshot();
+    lval* f = lval_pop(a, 0);
+    s->f = image_pack(f);
+    s->args = image_pack(a);
+    s->out = lchan_new(1);
+    s->cache = lctx->cache;
+    lval_del(f);
+    lval_del(a);
+
+    lval* v = lval_chan(s->out);
+    th_thread t;
+    if (th_thread_create(&t, spawn_main, s) != 0) {
+        lpacked_free(s->image);
+        lpacked_free(s->f);
+        lpacked_free(s->args);
+        lchan_release(s->out);
+        free(s);
+        lval_del(v);
+        return lval_err("Function 'spawn' could not start a thread.");
+    }
+    th_thread_detach(t);
+    return v;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#ifndef _CHAN_H
+#define _CHAN_H
+
+#include "lsp.h"
+
+/* Channels carry values between interpreters, each running in its own
+   thread. A value sent is packed as an image packs it and rebuilt by
+   whoever receives it, so the two never share anything but channels */
+
+lval* builtin_make_chan(lenv* e, lval* a);
+lval* builtin_chan_send(lenv* e, lval* a);
+lval* builtin_chan_recv(lenv* e, lval* a);
+lval* builtin_chan_close(lenv* e, lval* a);
+lval* builtin_spawn(lenv* e, lval* a);
+
+#endif
@@ -20,7 +20,7 @@ struct ht {
     size_t length;      // number of items in hash table
 };
 
-#define INITIAL_CAPACITY 20  // must not be zero
+#define INITIAL_CAPACITY 16  // must be a power of two
 
 ht* ht_create(void) {
     // Allocate space for hash table struct.
@@ -196,4 +196,174 @@ bool ht_next(hti* it) {
         }
     }
     return false;
-}
\ No newline at end of file
+}
+
+// Object-keyed hash table entry (slot is empty if key is NULL).
+typedef struct {
+    uint64_t hash;
+    void* key;
+    void* value;
+} hto_entry;
+
+struct hto {
+    hto_entry* entries;  // hash slots
+    size_t capacity;     // size of _entries array, a power of two
+    size_t length;       // number of items in hash table
+    hto_eq eq;           // key equality
+};
+
+#define HTO_INITIAL_CAPACITY 16  // must be a power of two
+
+hto* hto_create(hto_eq eq) {
+    hto* table = malloc(sizeof(hto));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->length = 0;
+    table->capacity = HTO_INITIAL_CAPACITY;
+    table->eq = eq;
+    table->entries = calloc(table->capacity, sizeof(hto_entry));
+    if (table->entries == NULL) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+void hto_destroy(hto* table) {
+    free(table->entries);
+    free(table);
+}
+
+// Return index of key's slot, or of the empty slot where it would go.
+static size_t hto_find(hto_entry* entries, size_t capacity, hto_eq eq,
+    uint64_t hash, const void* key) {
+    size_t index = (size_t)(hash & (uint64_t)(capacity - 1));
+    while (entries[index].key != NULL) {
+        if (entries[index].hash == hash && eq(key, entries[index].key)) {
+            return index;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+    return index;
+}
+
+void* hto_get(hto* table, uint64_t hash, const void* key) {
+    size_t index = hto_find(table->entries, table->capacity, table->eq,
+        hash, key);
+    return table->entries[index].value;
+}
+
+static bool hto_expand(hto* table) {
+    size_t new_capacity = table->capacity * 2;
+    if (new_capacity < table->capacity) {
+        return false;
+    }
+    hto_entry* new_entries = calloc(new_capacity, sizeof(hto_entry));
+    if (new_entries == NULL) {
+        return false;
+    }
+
+    // Keys are known distinct, so just drop them in the first free slot.
+    for (size_t i = 0; i < table->capacity; i++) {
+        hto_entry entry = table->entries[i];
+        if (entry.key != NULL) {
+            size_t index = (size_t)(entry.hash & (uint64_t)(new_capacity - 1));
+            while (new_entries[index].key != NULL) {
+                index = (index + 1) & (new_capacity - 1);
+            }
+            new_entries[index] = entry;
+        }
+    }
+
+    free(table->entries);
+    table->entries = new_entries;
+    table->capacity = new_capacity;
+    return true;
+}
+
+const void* hto_set(hto* table, uint64_t hash, void* key, void* value,
+    void** old) {
+    assert(key != NULL && value != NULL);
+    *old = NULL;
+
+    // If length will exceed half of current capacity, expand it.
+    if (table->length >= table->capacity / 2) {
+        if (!hto_expand(table)) {
+            return NULL;
+        }
+    }
+
+    size_t index = hto_find(table->entries, table->capacity, table->eq,
+        hash, key);
+    if (table->entries[index].key != NULL) {
+        *old = table->entries[index].value;
+        table->entries[index].value = value;
+        return table->entries[index].key;
+    }
+
+    table->entries[index].hash = hash;
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->length++;
+    return key;
+}
+
+void* hto_remove(hto* table, uint64_t hash, const void* key,
+    void** old_key) {
+    size_t mask = table->capacity - 1;
+    size_t i = hto_find(table->entries, table->capacity, table->eq,
+        hash, key);
+    if (table->entries[i].key == NULL) {
+        return NULL;
+    }
+    void* value = table->entries[i].value;
+    *old_key = table->entries[i].key;
+    table->entries[i].key = NULL;
+    table->entries[i].value = NULL;
+    table->length--;
+
+    // Shift back any following entries that probed past the hole.
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (table->entries[j].key == NULL) {
+            break;
+        }
+        size_t k = (size_t)(table->entries[j].hash & (uint64_t)mask);
+        bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            table->entries[i] = table->entries[j];
+            table->entries[j].key = NULL;
+            table->entries[j].value = NULL;
+            i = j;
+        }
+    }
+    return value;
+}
+
+size_t hto_length(hto* table) {
+    return table->length;
+}
+
+htoi hto_iterator(hto* table) {
+    htoi it;
+    it._table = table;
+    it._index = 0;
+    return it;
+}
+
+bool hto_next(htoi* it) {
+    hto* table = it->_table;
+    while (it->_index < table->capacity) {
+        size_t i = it->_index;
+        it->_index++;
+        if (table->entries[i].key != NULL) {
+            it->key = table->entries[i].key;
+            it->value = table->entries[i].value;
+            it->hash = table->entries[i].hash;
+            return true;
+        }
+    }
+    return false;
+}
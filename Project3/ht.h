@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // Hash table structure: create with ht_create, free with ht_destroy.
 typedef struct ht ht;
@@ -47,4 +48,55 @@ hti ht_iterator(ht* table);
 // items, return false. Don't call ht_set during iteration.
 bool ht_next(hti* it);
 
+// Hash table keyed by arbitrary objects: create with hto_create, free
+// with hto_destroy. The caller hashes keys and supplies the equality
+// test; keys and values are not copied or freed by the table.
+typedef struct hto hto;
+
+// Return true if two keys are equal.
+typedef bool (*hto_eq)(const void* a, const void* b);
+
+// Create object-keyed hash table, or return NULL if out of memory.
+hto* hto_create(hto_eq eq);
+
+// Free memory allocated for hash table (not its keys or values).
+void hto_destroy(hto* table);
+
+// Get item with given key and hash. Return value, or NULL if not found.
+void* hto_get(hto* table, uint64_t hash, const void* key);
+
+// Set item with given key and hash to value (which must not be NULL).
+// If the key is already present its value is replaced and the previous
+// value is stored in *old, otherwise *old is set to NULL. Return the key
+// kept by the table (the existing one on replace), or NULL if out of
+// memory.
+const void* hto_set(hto* table, uint64_t hash, void* key, void* value,
+    void** old);
+
+// Remove item with given key and hash. Return its value and store its
+// key in *old_key, or return NULL if not found.
+void* hto_remove(hto* table, uint64_t hash, const void* key,
+    void** old_key);
+
+// Return number of items in hash table.
+size_t hto_length(hto* table);
+
+// Object-keyed iterator: create with hto_iterator, iterate with hto_next.
+typedef struct {
+    const void* key;  // current key
+    void* value;      // current value
+    uint64_t hash;    // hash of current key
+
+    // Don't use these fields directly.
+    hto* _table;      // reference to hash table being iterated
+    size_t _index;    // current index into hto._entries
+} htoi;
+
+// Return new object-keyed iterator (for use with hto_next).
+htoi hto_iterator(hto* table);
+
+// Move iterator to next item, return false when there are no more.
+// Don't call hto_set or hto_remove during iteration.
+bool hto_next(htoi* it);
+
 #endif // _HT_H
\ No newline at end of file
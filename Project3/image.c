@@ -0,0 +1,751 @@
+#include "image.h"
+#include "reader.h"
+
+/* An image holds no pointers. Packages are numbered in registry order,
+   the root first, and builtins by their index in lbuiltins, so a file
+   mapped anywhere is decoded into a fresh heap.
+
+   header   magic, IMAGE_VERSION, LVER, sizeof(bignum), lbuiltins_count
+   gensym
+   packages count, then each name
+   for each package: its bindings, then its imports
+   shadowed count, then each name
+
+   An lval is its type byte followed by its contents.
+
+   A source cache has the same header with its own magic, then the hash
+   and length of the source, then the forms read from it, then IMG_END,
+   then the hash of every byte before it. Its symbols are made again as
+   the reader makes them, so they belong to whatever package is current
+   when each form is loaded.
+
+   Images and values packed in memory, to be rebuilt by another
+   interpreter, hold their channels aside and refer to them by number.
+   A packed value names the package of each symbol.
+
+   Natives the host registered are not in lbuiltins and are never
+   written. A binding to one is left out, one inside a value is written
+   as () */
+
+static const char magic[8] = "LSPYIMG";
+static const char cache_magic[8] = "LSPYLSC";
+
+/* Byte after the last form of a source cache */
+#define IMG_END 0xFF
+
+/* Function kinds */
+enum { IMG_BUILTIN, IMG_LAMBDA, IMG_MEMO };
+
+/* 64-bit FNV-1a, h continuing the hash of the bytes before p */
+#define HASH_START 14695981039346656037ULL
+
+static uint64_t hash_more(uint64_t h, const unsigned char* p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_bytes(const unsigned char* p, size_t n) {
+    return hash_more(HASH_START, p, n);
+}
+
+/* Packages in registry order, the root first */
+static int pack_list(pack*** out) {
+    int n = 1 + lctx->rootpack->pcount;
+    pack** ps = malloc(sizeof(pack*) * n);
+    ps[0] = lctx->rootpack;
+
+    /* Children are kept newest first, number them oldest first */
+    int i = n;
+    for (pack* p = lctx->rootpack->children; p; p = p->next) { ps[--i] = p; }
+    *out = ps;
+    return n;
+}
+
+/* Writing */
+
+typedef struct iwriter {
+    FILE* f;                   /* file written, NULL to write to memory */
+    unsigned char* buf;
+    size_t len;
+    size_t cap;
+    pack** packs;
+    int npacks;
+    int cache;                 /* writing a source cache */
+    uint64_t sum;              /* its hash so far */
+    int msg;                   /* writing a packed value */
+    lchan** chans;             /* channels met when writing to memory */
+    int nchans;
+} iwriter;
+
+static void iwriter_init(iwriter* w, FILE* f) {
+    w->f = f;
+    w->buf = NULL;
+    w->len = 0;
+    w->cap = 0;
+    w->packs = NULL;
+    w->npacks = 0;
+    w->cache = 0;
+    w->sum = HASH_START;
+    w->msg = 0;
+    w->chans = NULL;
+    w->nchans = 0;
+}
+
+static void put_bytes(iwriter* w, const void* p, size_t n) {
+    if (w->cache) { w->sum = hash_more(w->sum, p, n); }
+    if (w->f) {
+        fwrite(p, 1, n, w->f);
+        return;
+    }
+    if (w->len + n > w->cap) {
+        while (w->len + n > w->cap) { w->cap = w->cap ? w->cap * 2 : 256; }
+        w->buf = realloc(w->buf, w->cap);
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static void put_u8(iwriter* w, int x) {
+    unsigned char c = (unsigned char)x;
+    put_bytes(w, &c, 1);
+}
+
+static void put_u32(iwriter* w, uint32_t x) {
+    put_bytes(w, &x, sizeof(x));
+}
+
+static void put_i64(iwriter* w, int64_t x) {
+    put_bytes(w, &x, sizeof(x));
+}
+
+/* Length with the terminator, then the bytes */
+static void put_str(iwriter* w, const char* s) {
+    uint32_t n = (uint32_t)strlen(s) + 1;
+    put_u32(w, n);
+    put_bytes(w, s, n);
+}
+
+static int pack_index(iwriter* w, pack* p) {
+    for (int i = 0; i < w->npacks; i++) {
+        if (w->packs[i] == p) { return i; }
+    }
+    return -1;
+}
+
+static void put_lval(iwriter* w, lval* v);
+
+/* Index of a builtin in lbuiltins, lbuiltins_count for a native */
+static int builtin_index(lbuiltin f) {
+    int i = 0;
+    while (i < lbuiltins_count && lbuiltins[i].func != f) { i++; }
+    return i;
+}
+
+/* A native the host registered, which no other interpreter has */
+static int is_native(lval* v) {
+    return v->type == LVAL_FUN && !v->memo && v->builtin &&
+        builtin_index(v->builtin) == lbuiltins_count;
+}
+
+/* Bindings to natives are left out */
+static void put_env(iwriter* w, lenv* e) {
+    uint32_t n = 0;
+    if (e->h1) {
+        hti it = ht_iterator(e->h1);
+        while (ht_next(&it)) { n += !is_native(it.value); }
+        put_u32(w, n);
+        it = ht_iterator(e->h1);
+        while (ht_next(&it)) {
+            if (is_native(it.value)) { continue; }
+            put_str(w, it.key);
+            put_lval(w, it.value);
+        }
+    }
+    else {
+        for (int i = 0; i < e->count; i++) { n += !is_native(e->vals[i]); }
+        put_u32(w, n);
+        for (int i = 0; i < e->count; i++) {
+            if (is_native(e->vals[i])) { continue; }
+            put_str(w, e->syms[i]);
+            put_lval(w, e->vals[i]);
+        }
+    }
+}
+
+static void put_lval(iwriter* w, lval* v) {
+    /* A future is saved as its value */
+    if (v->type == LVAL_FUT) {
+        put_lval(w, lfut_value(v->fut));
+        return;
+    }
+    /* A channel only lives in the process, a file gets () instead. A
+       native inside a value gets () wherever it goes */
+    if ((v->type == LVAL_CHAN && w->f) || is_native(v)) {
+        put_u8(w, LVAL_SEXPR);
+        put_u8(w, 0);
+        put_u32(w, 0);
+        return;
+    }
+    put_u8(w, v->type);
+    switch (v->type) {
+    case LVAL_INUM: put_i64(w, v->inum); break;
+    case LVAL_DNUM: put_bytes(w, &v->dnum, sizeof(double)); break;
+    case LVAL_BNUM: put_bytes(w, &v->bnum, sizeof(bignum)); break;
+    case LVAL_ERR:  put_str(w, v->err); break;
+    case LVAL_STR:  put_str(w, v->str); break;
+    case LVAL_SYM:
+        put_str(w, v->sym);
+        if (w->msg) { put_str(w, v->pkg ? v->pkg->name : ""); }
+        else if (!w->cache) { put_u32(w, (uint32_t)pack_index(w, v->pkg)); }
+        break;
+    case LVAL_CHAN:
+        lchan_retain(v->chan);
+        w->chans = realloc(w->chans, sizeof(lchan*) * (w->nchans + 1));
+        w->chans[w->nchans] = v->chan;
+        put_u32(w, (uint32_t)w->nchans++);
+        break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        put_u8(w, v->ic != NULL);
+        put_u32(w, (uint32_t)v->count);
+        for (int i = 0; i < v->count; i++) { put_lval(w, v->cell[i]); }
+        break;
+    case LVAL_MAP: {
+        put_u32(w, (uint32_t)hto_length(v->map->table));
+        htoi it = hto_iterator(v->map->table);
+        while (hto_next(&it)) {
+            put_lval(w, (lval*)it.key);
+            put_lval(w, it.value);
+        }
+        break;
+    }
+    case LVAL_VEC:
+        put_u32(w, (uint32_t)v->vec->count);
+        for (int i = 0; i < v->vec->count; i++) {
+            put_lval(w, v->vec->items[i]);
+        }
+        break;
+    case LVAL_FUN:
+        if (v->memo) {
+            /* The results are not kept, only the function */
+            put_u8(w, IMG_MEMO);
+            put_u32(w, (uint32_t)v->memo->capacity);
+            put_lval(w, v->memo->fn);
+        }
+        else if (v->builtin) {
+            put_u8(w, IMG_BUILTIN);
+            put_u32(w, (uint32_t)builtin_index(v->builtin));
+        }
+        else {
+            /* Closure bindings are saved by value */
+            put_u8(w, IMG_LAMBDA);
+            put_u8(w, v->env->closure != NULL);
+            if (v->env->closure) { put_env(w, v->env->closure); }
+            put_env(w, v->env);
+            put_lval(w, v->formals);
+            put_lval(w, v->body);
+        }
+        break;
+    }
+}
+
+static void put_header(iwriter* w, const char* m) {
+    put_bytes(w, m, sizeof(magic));
+    put_u32(w, IMAGE_VERSION);
+    double ver = LVER;
+    put_bytes(w, &ver, sizeof(ver));
+    put_u32(w, sizeof(bignum));
+    put_u32(w, (uint32_t)lbuiltins_count);
+}
+
+static void put_image(iwriter* w) {
+    w->npacks = pack_list(&w->packs);
+
+    put_header(w, magic);
+    put_i64(w, lctx->gensym);
+
+    put_u32(w, (uint32_t)w->npacks);
+    for (int i = 0; i < w->npacks; i++) { put_str(w, w->packs[i]->name); }
+
+    for (int i = 0; i < w->npacks; i++) {
+        pack* p = w->packs[i];
+        put_env(w, p->env);
+
+        put_u32(w, p->imports ? (uint32_t)ht_length(p->imports) : 0);
+        if (p->imports) {
+            hti it = ht_iterator(p->imports);
+            while (ht_next(&it)) {
+                put_str(w, it.key);
+                put_u32(w, (uint32_t)pack_index(w, it.value));
+            }
+        }
+    }
+
+    put_u32(w, lctx->shadowed ? (uint32_t)ht_length(lctx->shadowed) : 0);
+    if (lctx->shadowed) {
+        hti it = ht_iterator(lctx->shadowed);
+        while (ht_next(&it)) { put_str(w, it.key); }
+    }
+
+    free(w->packs);
+    w->packs = NULL;
+}
+
+/* What a writer to memory wrote, taking over its buffer and channels */
+static lpacked* packed_take(iwriter* w) {
+    lpacked* p = malloc(sizeof(lpacked));
+    p->data = w->buf;
+    p->len = w->len;
+    p->chans = w->chans;
+    p->nchans = w->nchans;
+    return p;
+}
+
+lval* image_save(const char* path) {
+    iwriter w;
+    iwriter_init(&w, fopen(path, "wb"));
+    if (!w.f) {
+        return lval_err("Could not save image %s: %s", path, strerror(errno));
+    }
+    lpar_quiesce();
+    put_image(&w);
+    int failed = ferror(w.f);
+    if (fclose(w.f) != 0 || failed) {
+        return lval_err("Could not save image %s: write failed", path);
+    }
+    return lval_sexpr();
+}
+
+lpacked* image_snapshot(void) {
+    iwriter w;
+    iwriter_init(&w, NULL);
+    put_image(&w);
+    return packed_take(&w);
+}
+
+lpacked* image_pack(lval* v) {
+    iwriter w;
+    iwriter_init(&w, NULL);
+    w.msg = 1;
+    put_lval(&w, v);
+    return packed_take(&w);
+}
+
+void lpacked_free(lpacked* p) {
+    for (int i = 0; i < p->nchans; i++) { lchan_release(p->chans[i]); }
+    free(p->chans);
+    free(p->data);
+    free(p);
+}
+
+/* Reading */
+
+typedef struct ireader {
+    const unsigned char* p;
+    const unsigned char* end;
+    int bad;                   /* ran past the end or met a bad value */
+    pack** packs;
+    int npacks;
+    int cache;                 /* reading a source cache */
+    int msg;                   /* reading a packed value */
+    lpacked* from;             /* channels of what is read from memory */
+} ireader;
+
+static int have(ireader* r, size_t n) {
+    if (r->bad || (size_t)(r->end - r->p) < n) { r->bad = 1; return 0; }
+    return 1;
+}
+
+static void get_bytes(ireader* r, void* out, size_t n) {
+    if (!have(r, n)) { memset(out, 0, n); return; }
+    memcpy(out, r->p, n);
+    r->p += n;
+}
+
+static int get_u8(ireader* r) {
+    unsigned char c;
+    get_bytes(r, &c, 1);
+    return c;
+}
+
+static uint32_t get_u32(ireader* r) {
+    uint32_t x;
+    get_bytes(r, &x, sizeof(x));
+    return x;
+}
+
+static int64_t get_i64(ireader* r) {
+    int64_t x;
+    get_bytes(r, &x, sizeof(x));
+    return x;
+}
+
+/* A string in place in the image */
+static char* get_str(ireader* r) {
+    uint32_t n = get_u32(r);
+    if (n == 0 || !have(r, n) || r->p[n - 1] != '\0') {
+        r->bad = 1;
+        return "";
+    }
+    char* s = (char*)r->p;
+    r->p += n;
+    return s;
+}
+
+static pack* get_pack(ireader* r) {
+    uint32_t i = get_u32(r);
+    if (i == (uint32_t)-1) { return NULL; }
+    if (i >= (uint32_t)r->npacks) { r->bad = 1; return NULL; }
+    return r->packs[i];
+}
+
+static lval* get_lval(ireader* r);
+
+static void get_env(ireader* r, lenv* e) {
+    lval k;
+    k.type = LVAL_SYM;
+    uint32_t n = get_u32(r);
+    for (uint32_t i = 0; i < n && !r->bad; i++) {
+        k.sym = get_str(r);
+        lval* v = get_lval(r);
+        lenv_put(e, &k, v);
+        lval_del(v);
+    }
+}
+
+static lval* get_lval(ireader* r) {
+    int type = get_u8(r);
+    if (r->bad) { return lval_sexpr(); }
+
+    lval* x;
+    switch (type) {
+    case LVAL_INUM: return lval_inum((intptr_t)get_i64(r));
+    case LVAL_DNUM: {
+        double d;
+        get_bytes(r, &d, sizeof(d));
+        return lval_dnum(d);
+    }
+    case LVAL_BNUM: {
+        bignum b;
+        get_bytes(r, &b, sizeof(b));
+        return lval_bnum(b);
+    }
+    case LVAL_ERR: return lval_err("%s", get_str(r));
+    case LVAL_STR: return lval_str(get_str(r));
+    case LVAL_SYM:
+        if (r->cache) {
+            /* An unknown package ends the cached forms, the reader then
+               reports where it is named, see builtin_load */
+            x = lreader_sym(get_str(r));
+            if (!x) { r->bad = 1; return lval_sexpr(); }
+            return x;
+        }
+        x = lval_sym(get_str(r));
+        if (r->msg) {
+            /* Packages the interpreter lacks leave the symbol unqualified */
+            char* name = get_str(r);
+            x->pkg = *name ? pack_find(name) : NULL;
+        }
+        else { x->pkg = get_pack(r); }
+        return x;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: {
+        int ic = get_u8(r);
+        uint32_t n = get_u32(r);
+        if (!have(r, n)) { return lval_sexpr(); }
+        x = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+        x->count = (int)n;
+        x->cell = malloc(sizeof(lval*) * (n ? n : 1));
+        for (uint32_t i = 0; i < n; i++) { x->cell[i] = get_lval(r); }
+        if (ic) { x->ic = lic_new(); }
+        return x;
+    }
+    case LVAL_MAP: {
+        x = lval_map();
+        uint32_t n = get_u32(r);
+        for (uint32_t i = 0; i < n && !r->bad; i++) {
+            lval* k = get_lval(r);
+            lmap_put(x->map, k, get_lval(r));
+        }
+        return x;
+    }
+    case LVAL_VEC: {
+        uint32_t n = get_u32(r);
+        if (!have(r, n)) { return lval_sexpr(); }
+        x = lval_vec((int)n);
+        for (uint32_t i = 0; i < n; i++) { lvec_push(x->vec, get_lval(r)); }
+        return x;
+    }
+    case LVAL_CHAN: {
+        uint32_t i = get_u32(r);
+        if (!r->from || i >= (uint32_t)r->from->nchans) { break; }
+        return lval_chan(r->from->chans[i]);
+    }
+    case LVAL_FUN:
+        switch (get_u8(r)) {
+        case IMG_BUILTIN: {
+            uint32_t i = get_u32(r);
+            if (i >= (uint32_t)lbuiltins_count) { r->bad = 1; return lval_sexpr(); }
+            return lval_builtin(lbuiltins[i].func);
+        }
+        case IMG_MEMO: {
+            int capacity = (int)get_u32(r);
+            x = lval_builtin(NULL);
+            x->memo = memo_new(get_lval(r), capacity);
+            return x;
+        }
+        case IMG_LAMBDA: {
+            x = lval_builtin(NULL);
+            x->env = lenv_new();
+            if (get_u8(r)) {
+                x->env->closure = lenv_new();
+                get_env(r, x->env->closure);
+            }
+            get_env(r, x->env);
+            x->formals = get_lval(r);
+            x->body = get_lval(r);
+            return x;
+        }
+        }
+    }
+
+    r->bad = 1;
+    return lval_sexpr();
+}
+
+static void ireader_init(ireader* r, void* map, size_t len) {
+    r->p = map;
+    r->end = r->p + len;
+    r->bad = 0;
+    r->packs = NULL;
+    r->npacks = 0;
+    r->cache = 0;
+    r->msg = 0;
+    r->from = NULL;
+}
+
+/* 0 for a header with magic m written by this lispy, -1 if it is not
+   one at all, 1 if it was written by another version */
+static int get_header(ireader* r, const char* m) {
+    char got[sizeof(magic)];
+    double ver;
+    get_bytes(r, got, sizeof(got));
+    uint32_t version = get_u32(r);
+    get_bytes(r, &ver, sizeof(ver));
+    uint32_t bsize = get_u32(r);
+    uint32_t nbuiltins = get_u32(r);
+    if (r->bad || memcmp(got, m, sizeof(got)) != 0) { return -1; }
+    if (version != IMAGE_VERSION || ver != LVER || bsize != sizeof(bignum) ||
+        nbuiltins != (uint32_t)lbuiltins_count) { return 1; }
+    return 0;
+}
+
+/* Rebuild the image r reads, path naming it in errors */
+static lval* get_image(ireader* r, const char* path) {
+    int h = get_header(r, magic);
+    if (h != 0) {
+        return h < 0 ? lval_err("%s is not a lispy image", path) :
+            lval_err("Image %s was saved by a different lispy", path);
+    }
+    lctx->gensym = (long)get_i64(r);
+
+    /* Recreate the packages first so symbols can refer to them */
+    uint32_t n = get_u32(r);
+    if (n == 0 || !have(r, n)) { r->bad = 1; n = 0; }
+    r->packs = malloc(sizeof(pack*) * (n ? n : 1));
+    r->npacks = (int)n;
+    for (uint32_t i = 0; i < n; i++) {
+        char* name = get_str(r);
+        r->packs[i] = i == 0 ? lctx->rootpack : pack_new(name);
+    }
+
+    for (int i = 0; i < r->npacks && !r->bad; i++) {
+        pack* p = r->packs[i];
+        get_env(r, p->env);
+
+        uint32_t k = get_u32(r);
+        if (k && !p->imports) { p->imports = ht_create(); }
+        for (uint32_t j = 0; j < k && !r->bad; j++) {
+            char* name = get_str(r);
+            pack* from = get_pack(r);
+            if (from) { ht_set(p->imports, name, from); }
+        }
+    }
+
+    n = get_u32(r);
+    if (n && !lctx->shadowed) { lctx->shadowed = ht_create(); }
+    for (uint32_t i = 0; i < n && !r->bad; i++) {
+        ht_set(lctx->shadowed, get_str(r), lctx->shadowed);
+    }
+
+    free(r->packs);
+    lctx->currpack = lctx->rootpack;
+
+    if (r->bad) { return lval_err("Image %s is damaged", path); }
+    return lval_sexpr();
+}
+
+lval* image_load(const char* path) {
+    size_t len;
+    void* map = lfile_map(path, &len);
+    if (!map) {
+        return lval_err("Could not load image %s", path);
+    }
+    ireader r;
+    ireader_init(&r, map, len);
+    lval* x = get_image(&r, path);
+    lfile_unmap(map, len);
+    return x;
+}
+
+lval* image_restore(lpacked* p) {
+    ireader r;
+    ireader_init(&r, p->data, p->len);
+    r.from = p;
+    return get_image(&r, "snapshot");
+}
+
+lval* image_unpack(lpacked* p) {
+    ireader r;
+    ireader_init(&r, p->data, p->len);
+    r.msg = 1;
+    r.from = p;
+    lval* x = get_lval(&r);
+    if (r.bad) {
+        lval_del(x);
+        return lval_err("Packed value is damaged");
+    }
+    return x;
+}
+
+/* Source caches */
+
+struct lcache {
+    void* map;                 /* sidecar being read */
+    size_t len;
+    ireader r;
+    iwriter w;                 /* or sidecar being written */
+    char* path;
+    char* tmp;
+};
+
+/* Hash and length of the source at src, 0 if it cannot be mapped */
+static int source_key(const char* src, uint64_t* hash, uint64_t* len) {
+    size_t n;
+    void* p = lfile_map(src, &n);
+    if (!p) { return 0; }
+    *hash = hash_bytes(p, n);
+    *len = n;
+    lfile_unmap(p, n);
+    return 1;
+}
+
+/* foo.lsp caches to foo.lspc, anything else gets .lspc appended */
+static char* cache_path(const char* src) {
+    size_t n = strlen(src);
+    char* p = malloc(n + 6);
+    strcpy(p, src);
+    if (n >= 4 && strcmp(src + n - 4, ".lsp") == 0) { strcat(p, "c"); }
+    else { strcat(p, ".lspc"); }
+    return p;
+}
+
+lcache* lcache_open(const char* src) {
+    uint64_t hash, len;
+    if (!lctx->cache || !source_key(src, &hash, &len)) { return NULL; }
+
+    lcache* c = malloc(sizeof(lcache));
+    c->path = cache_path(src);
+    c->map = lfile_map(c->path, &c->len);
+    if (!c->map) { free(c->path); free(c); return NULL; }
+
+    /* The whole sidecar is checked before any of it is used, so one
+       damaged or cut short is read again from source and rewritten */
+    const unsigned char* p = c->map;
+    uint64_t sum;
+    if (c->len < 1 + sizeof(sum)) { lcache_close(c); return NULL; }
+    size_t n = c->len - sizeof(sum);
+    memcpy(&sum, p + n, sizeof(sum));
+    if (p[n - 1] != IMG_END || hash_bytes(p, n) != sum) {
+        lcache_close(c);
+        return NULL;
+    }
+
+    ireader_init(&c->r, c->map, n);
+    c->r.cache = 1;
+    if (get_header(&c->r, cache_magic) != 0 ||
+        (uint64_t)get_i64(&c->r) != hash || (uint64_t)get_i64(&c->r) != len) {
+        lcache_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+lval* lcache_next(lcache* c) {
+    if (c->r.bad || !have(&c->r, 1) || *c->r.p == IMG_END) { return NULL; }
+    lval* x = get_lval(&c->r);
+    if (c->r.bad) {
+        lval_del(x);
+        return NULL;
+    }
+    return x;
+}
+
+int lcache_complete(lcache* c) {
+    return !c->r.bad;
+}
+
+void lcache_close(lcache* c) {
+    lfile_unmap(c->map, c->len);
+    free(c->path);
+    free(c);
+}
+
+lcache* lcache_create(const char* src) {
+    uint64_t hash, len;
+    if (!lctx->cache || !source_key(src, &hash, &len)) { return NULL; }
+
+    /* Written aside and renamed into place once complete */
+    lcache* c = malloc(sizeof(lcache));
+    c->path = cache_path(src);
+    c->tmp = lfile_tmpname(c->path);
+    iwriter_init(&c->w, fopen(c->tmp, "wb"));
+    if (!c->w.f) {
+        free(c->path);
+        free(c->tmp);
+        free(c);
+        return NULL;
+    }
+    c->w.cache = 1;
+
+    put_header(&c->w, cache_magic);
+    put_i64(&c->w, (int64_t)hash);
+    put_i64(&c->w, (int64_t)len);
+    return c;
+}
+
+void lcache_add(lcache* c, lval* form) {
+    put_lval(&c->w, form);
+}
+
+void lcache_finish(lcache* c, int keep) {
+    put_u8(&c->w, IMG_END);
+    uint64_t sum = c->w.sum;
+    put_bytes(&c->w, &sum, sizeof(sum));
+    int failed = ferror(c->w.f);
+    failed |= fclose(c->w.f) != 0;
+
+    if (keep && !failed) {
+        remove(c->path);
+        if (rename(c->tmp, c->path) != 0) { remove(c->tmp); }
+    }
+    else {
+        remove(c->tmp);
+    }
+    free(c->path);
+    free(c->tmp);
+    free(c);
+}
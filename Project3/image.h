@@ -0,0 +1,60 @@
+#pragma once
+
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include "lsp.h"
+
+/* Bumped whenever the layout of an image changes */
+#define IMAGE_VERSION 1
+
+/* Write every package, its bindings and imports to path. Returns an
+   empty expression, or an error */
+lval* image_save(const char* path);
+
+/* Rebuild the packages saved in path, in place of lenv_add_builtins.
+   Returns an empty expression, or an error */
+lval* image_load(const char* path);
+
+/* An image or a value written to memory, for another interpreter of
+   the process to rebuild. It holds the channels it refers to */
+typedef struct lpacked {
+    unsigned char* data;
+    size_t len;
+    lchan** chans;
+    int nchans;
+} lpacked;
+
+/* Every package of the current interpreter, and its rebuilding in place
+   of lenv_add_builtins, as image_load does */
+lpacked* image_snapshot(void);
+lval* image_restore(lpacked* p);
+
+/* A deep copy of v, rebuilt in whatever interpreter is current by
+   image_unpack. Both leave their argument as is */
+lpacked* image_pack(lval* v);
+lval* image_unpack(lpacked* p);
+void lpacked_free(lpacked* p);
+
+/* Forms read from a source file, kept in a sidecar next to it */
+typedef struct lcache lcache;
+
+/* The sidecar of src if it was written from src as it is now, else NULL */
+lcache* lcache_open(const char* src);
+
+/* Next form of the sidecar, NULL after the last or at one naming a
+   package that does not exist. lcache_complete tells which */
+lval* lcache_next(lcache* c);
+int lcache_complete(lcache* c);
+void lcache_close(lcache* c);
+
+/* Start a new sidecar for src, NULL if there will be none */
+lcache* lcache_create(const char* src);
+
+/* Append a form just read, before it is evaluated */
+void lcache_add(lcache* c, lval* form);
+
+/* Close the sidecar, keeping it only if the whole file was read */
+void lcache_finish(lcache* c, int keep);
+
+#endif
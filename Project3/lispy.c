@@ -0,0 +1,168 @@
+#include "lsp.h"
+#include "reader.h"
+#include "lispy.h"
+
+/* Each call runs in the caller's context and gives the thread back the
+   one it had, so contexts can be nested and shared across calls */
+#define LISPY_ENTER(c) lispy_ctx* saved = lctx; lctx = (c)
+#define LISPY_LEAVE() lctx = saved
+
+lispy_ctx* lispy_open(void) {
+    lispy_ctx* c = lctx_new();
+    LISPY_ENTER(c);
+    lenv_add_builtins(c->rootenv);
+    LISPY_LEAVE();
+    return c;
+}
+
+void lispy_close(lispy_ctx* c) {
+    lctx_del(c);
+}
+
+lval* lispy_eval_string(lispy_ctx* c, const char* src) {
+    LISPY_ENTER(c);
+    lreader r;
+    lreader_init(&r, "<string>", src, strlen(src));
+    lval* last = lval_sexpr();
+    lval* x;
+    while ((x = lreader_next(&r))) {
+        lval_del(last);
+        last = r.failed ? x : lval_eval(c->rootenv, x);
+        if (last->type == LVAL_ERR) { break; }
+    }
+    LISPY_LEAVE();
+    return last;
+}
+
+lval* lispy_read(lispy_ctx* c, const char* src) {
+    LISPY_ENTER(c);
+    lreader r;
+    lreader_init(&r, "<string>", src, strlen(src));
+    lval* x = lreader_all(&r);
+    if (!r.failed && x->count == 1) { x = lval_take(x, 0); }
+    LISPY_LEAVE();
+    return x;
+}
+
+lval* lispy_eval(lispy_ctx* c, lval* form) {
+    LISPY_ENTER(c);
+    lval* x = lval_eval(c->rootenv, lval_copy(form));
+    LISPY_LEAVE();
+    return x;
+}
+
+lval* lispy_load(lispy_ctx* c, const char* path) {
+    LISPY_ENTER(c);
+    lval* x = builtin_load(c->rootenv, lval_add(lval_sexpr(), lval_str((char*)path)));
+    LISPY_LEAVE();
+    return x;
+}
+
+void lispy_def(lispy_ctx* c, const char* name, lval* v) {
+    LISPY_ENTER(c);
+    lval* k = lval_sym((char*)name);
+    lenv_def(c->rootenv, k, v);
+    lval_del(k); lval_del(v);
+    LISPY_LEAVE();
+}
+
+lval* lispy_get(lispy_ctx* c, const char* name) {
+    LISPY_ENTER(c);
+    lval* k = lval_sym((char*)name);
+    lval* x = lenv_get(c->rootenv, k);
+    lval_del(k);
+    LISPY_LEAVE();
+    return x;
+}
+
+void lispy_register(lispy_ctx* c, const char* name, lispy_native fn) {
+    LISPY_ENTER(c);
+    lpar_quiesce();
+    lenv_add_builtin(c->rootenv, (char*)name, fn);
+    /* Call sites may have cached whatever name was bound to */
+    c->ic_version++;
+    LISPY_LEAVE();
+}
+
+lval* lispy_call(lispy_ctx* c, lval* fn, lval* args) {
+    if (fn->type != LVAL_FUN) {
+        lval_del(args);
+        return lval_err("Cannot call %s.", ltype_name(fn->type));
+    }
+    LISPY_ENTER(c);
+    args->type = LVAL_SEXPR;
+    lval* x = lval_call(c->rootenv, fn, args);
+    LISPY_LEAVE();
+    return x;
+}
+
+/* The batch calls skip the reader and the lookup of fn, each input is
+   bound straight into a call frame */
+void lispy_map(lispy_ctx* c, lval* fn, lval** in, lval** out, int n) {
+    LISPY_ENTER(c);
+    for (int i = 0; i < n; i++) {
+        out[i] = fn->type == LVAL_FUN
+            ? lval_call(c->rootenv, fn, lval_add(lval_sexpr(), lval_copy(in[i])))
+            : lval_err("Cannot call %s.", ltype_name(fn->type));
+    }
+    LISPY_LEAVE();
+}
+
+int lispy_map_double(lispy_ctx* c, lval* fn, const double* in, double* out, int n) {
+    if (fn->type != LVAL_FUN) { return 0; }
+    LISPY_ENTER(c);
+    int i;
+    for (i = 0; i < n; i++) {
+        lval* x = lval_call(c->rootenv, fn, lval_add(lval_sexpr(), lval_dnum(in[i])));
+        int ok = x->type == LVAL_INUM || x->type == LVAL_DNUM;
+        if (ok) { out[i] = lispy_to_double(x); }
+        lval_del(x);
+        if (!ok) { break; }
+    }
+    LISPY_LEAVE();
+    return i;
+}
+
+lval* lispy_int(intptr_t x) { return lval_inum(x); }
+lval* lispy_double(double x) { return lval_dnum(x); }
+lval* lispy_string(const char* s) { return lval_str((char*)s); }
+lval* lispy_error(const char* msg) { return lval_err("%s", msg); }
+lval* lispy_list(void) { return lval_qexpr(); }
+lval* lispy_push(lval* l, lval* x) { return lval_add(l, x); }
+lval* lispy_copy(lval* v) { return lval_copy(v); }
+void lispy_free(lval* v) { lval_del(v); }
+int lispy_type(lval* v) { return v->type; }
+
+intptr_t lispy_to_int(lval* v) {
+    if (v->type == LVAL_INUM) { return v->inum; }
+    if (v->type == LVAL_DNUM) { return (intptr_t)v->dnum; }
+    return 0;
+}
+
+double lispy_to_double(lval* v) {
+    if (v->type == LVAL_DNUM) { return v->dnum; }
+    if (v->type == LVAL_INUM) { return (double)v->inum; }
+    return 0;
+}
+
+const char* lispy_to_string(lval* v) {
+    switch (v->type) {
+    case LVAL_STR: return v->str;
+    case LVAL_SYM: return v->sym;
+    case LVAL_ERR: return v->err;
+    }
+    return NULL;
+}
+
+int lispy_count(lval* v) {
+    switch (v->type) {
+    case LVAL_SEXPR: case LVAL_QEXPR: return v->count;
+    case LVAL_VEC: return v->vec->count;
+    }
+    return 0;
+}
+
+lval* lispy_item(lval* v, int i) {
+    if (i < 0 || i >= lispy_count(v)) { return NULL; }
+    return v->type == LVAL_VEC ? v->vec->items[i] : v->cell[i];
+}
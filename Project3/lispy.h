@@ -0,0 +1,102 @@
+#pragma once
+
+#ifndef _LISPY_H
+#define _LISPY_H
+
+/* Embedding API. A program links the interpreter built with LISPY_EMBED
+   defined, which leaves out main, and drives it through these calls.
+
+   Every lval handed out is owned by the caller and released with
+   lispy_free, unless said otherwise. A context is used by one thread at
+   a time, different contexts can run in different threads */
+
+#include <stdint.h>
+
+typedef struct lval lval;
+typedef struct lenv lenv;
+typedef struct lispy_ctx lispy_ctx;
+
+/* A native function. args is an s-expression of the evaluated arguments,
+   owned by the native, which returns a new value or a lispy_error */
+typedef lval* (*lispy_native)(lenv* e, lval* args);
+
+/* Value types, as returned by lispy_type */
+enum {
+    LISPY_ERR = 0, LISPY_INT, LISPY_DOUBLE, LISPY_SYM,
+    LISPY_BIGNUM, LISPY_STR, LISPY_SEXPR, LISPY_FUN, LISPY_QEXPR,
+    LISPY_MAP, LISPY_VEC, LISPY_FUT, LISPY_CHAN
+};
+
+/* A new interpreter with every builtin bound, and its teardown */
+lispy_ctx* lispy_open(void);
+void lispy_close(lispy_ctx* c);
+
+/* Evaluate every form in src, returning the value of the last one or
+   the first error */
+lval* lispy_eval_string(lispy_ctx* c, const char* src);
+
+/* Parse src once to evaluate it many times. A single form is returned
+   as is, several as one s-expression */
+lval* lispy_read(lispy_ctx* c, const char* src);
+
+/* Evaluate form, which is left untouched */
+lval* lispy_eval(lispy_ctx* c, lval* form);
+
+/* Load a source file as the load builtin does */
+lval* lispy_load(lispy_ctx* c, const char* path);
+
+/* Bind name globally to v, taking ownership of v */
+void lispy_def(lispy_ctx* c, const char* name, lval* v);
+
+/* The global bound to name, or an error if it is unbound */
+lval* lispy_get(lispy_ctx* c, const char* name);
+
+/* Bind name to a native function. Natives are not saved in images and
+   do not reach spawned interpreters or other threads through channels:
+   a binding to one is left out, and one inside a value becomes () */
+void lispy_register(lispy_ctx* c, const char* name, lispy_native fn);
+
+/* Call fn on the values in args, an s-expression or list it consumes.
+   fn is left untouched */
+lval* lispy_call(lispy_ctx* c, lval* fn, lval* args);
+
+/* Call fn on each of in[0..n), storing the results, errors included,
+   in out. The inputs are left untouched */
+void lispy_map(lispy_ctx* c, lval* fn, lval** in, lval** out, int n);
+
+/* The same over numbers. Returns how many results were stored, less
+   than n if a call did not return a number */
+int lispy_map_double(lispy_ctx* c, lval* fn, const double* in, double* out, int n);
+
+/* Values */
+lval* lispy_int(intptr_t x);
+lval* lispy_double(double x);
+lval* lispy_string(const char* s);
+lval* lispy_error(const char* msg);
+lval* lispy_list(void);
+
+/* Append x to the list or s-expression l, taking ownership of x */
+lval* lispy_push(lval* l, lval* x);
+
+/* These need no context, but a function or memo still refers to the
+   environments of the context it came from, so it is freed before that
+   context is closed */
+lval* lispy_copy(lval* v);
+void lispy_free(lval* v);
+
+int lispy_type(lval* v);
+
+/* Numbers converted to C, 0 for anything else */
+intptr_t lispy_to_int(lval* v);
+double lispy_to_double(lval* v);
+
+/* Text of a string, symbol or error, NULL for anything else. It lives
+   as long as v */
+const char* lispy_to_string(lval* v);
+
+/* Elements of a list, s-expression or vector. lispy_item returns the
+   element in place, it is not to be freed */
+int lispy_count(lval* v);
+lval* lispy_item(lval* v, int i);
+
+#endif
@@ -1,24 +1,26 @@
 #include "longint.h"
+#include "thpool.h"
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 int compare_bignum(bignum* a, bignum* b);
 void zero_justify(bignum* n);
+static int bignum_to_words(bignum* n, uint32_t* w);
+static int words_to_bignum(uint32_t* w, int nw, int sign, bignum* n);
 
 void print_bignum(bignum* n)
 {
-	int i;
-
-	if (n->signbit == MINUS) printf("- ");
-	for (i = n->lastdigit; i >= 0; i--)
-		printf("%c", '0' + n->digits[i]);
+	char s[BNCHARS];
 
-	//printf("\n");
+	bignum_to_string(n, 10, s);
+	fputs(s, stdout);
 }
 
 void int_to_bignum(intptr_t s, bignum* n)
 {
 	int i;				/* counter */
-	intptr_t t;				/* int to work with */
+	uintptr_t t;			/* magnitude to work with */
 
 	if (s >= 0) n->signbit = PLUS;
 	else n->signbit = MINUS;
@@ -27,7 +29,8 @@ void int_to_bignum(intptr_t s, bignum* n)
 
 	n->lastdigit = -1;
 
-	t = llabs(s);
+	/* negated unsigned, as -INTPTR_MIN does not fit */
+	t = (s < 0) ? 0 - (uintptr_t)s : (uintptr_t)s;
 
 	while (t > 0) {
 		n->lastdigit++;
@@ -168,22 +171,198 @@ void digit_shift(bignum* n, int d)		/* multiply n by 10^d */
 
 
 
-void multiply_bignum(bignum* a, bignum* b, bignum* c)
+/*	number theoretic transform, three primes recombined with CRT	*/
+
+#define NTT_LIMB	1000000		/* digits are packed 6 to a limb */
+#define NTT_LIMB_DIGITS	6
+#define NTT_SPLIT	(1 << 14)	/* shortest transform split across threads */
+
+static const uint32_t ntt_prime[3] = { 998244353, 167772161, 469762049 };
+
+static uint32_t pow_mod32(uint32_t b, uint64_t e, uint32_t m)
 {
-	bignum row;			/* represent shifted row */
-	bignum tmp;			/* placeholder bignum */
-	int i, j;			/* counters */
+	uint64_t r = 1, x = b % m;
+
+	for (; e; e >>= 1) {
+		if (e & 1) r = r * x % m;
+		x = x * x % m;
+	}
+	return((uint32_t)r);
+}
+
+typedef struct {
+	uint32_t* x;			/* data being transformed */
+	uint32_t* w;			/* roots of unity for length n */
+	uint32_t p;			/* prime modulus */
+	int n;				/* transform length */
+	int half;			/* half width of the current butterflies */
+	int chunks;			/* pieces the stage is cut into */
+} ntt_stage;
+
+static void ntt_butterflies(void* arg, int c)
+{
+	ntt_stage* s = (ntt_stage*)arg;
+	int total = s->n / 2;
+	int lo = (int)((int64_t)total * c / s->chunks);
+	int hi = (int)((int64_t)total * (c + 1) / s->chunks);
+	int step = s->n / (2 * s->half);
+	int k, j, i0, i1;
+	uint32_t u, v, p = s->p;
+
+	for (k = lo; k < hi; k++) {
+		j = k % s->half;
+		i0 = (k / s->half) * 2 * s->half + j;
+		i1 = i0 + s->half;
+		u = s->x[i0];
+		v = (uint32_t)((uint64_t)s->x[i1] * s->w[j * step] % p);
+		s->x[i0] = (u + v >= p) ? u + v - p : u + v;
+		s->x[i1] = (u >= v) ? u - v : u + p - v;
+	}
+}
+
+static void ntt(uint32_t* x, int n, uint32_t p, int invert)
+{
+	ntt_stage s;
+	uint32_t* w;
+	uint32_t root, t;
+	int i, j, bit;
+
+	for (i = 1, j = 0; i < n; i++) {
+		for (bit = n >> 1; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) { t = x[i]; x[i] = x[j]; x[j] = t; }
+	}
+
+	/* 3 generates the multiplicative group of all three primes */
+	root = pow_mod32(3, (p - 1) / n, p);
+	if (invert) root = pow_mod32(root, p - 2, p);
+	w = malloc(sizeof(uint32_t) * (n / 2 + 1));
+	w[0] = 1;
+	for (i = 1; i < n / 2; i++) w[i] = (uint32_t)((uint64_t)w[i - 1] * root % p);
+
+	s.x = x;
+	s.w = w;
+	s.p = p;
+	s.n = n;
+	s.chunks = (n >= NTT_SPLIT) ? 4 * thpool_size() : 1;
+
+	for (s.half = 1; s.half < n; s.half *= 2) {
+		if (s.chunks > 1) thpool_for(ntt_butterflies, &s, s.chunks);
+		else ntt_butterflies(&s, 0);
+	}
+
+	if (invert) {
+		t = pow_mod32(n, p - 2, p);
+		for (i = 0; i < n; i++) x[i] = (uint32_t)((uint64_t)x[i] * t % p);
+	}
+
+	free(w);
+}
+
+static int bignum_to_limbs(bignum* a, uint32_t* l)
+{
+	int i, k, n = 0;
+
+	for (i = 0; i <= a->lastdigit; i += NTT_LIMB_DIGITS, n++) {
+		l[n] = 0;
+		for (k = NTT_LIMB_DIGITS - 1; k >= 0; k--)
+			if (i + k <= a->lastdigit) l[n] = l[n] * 10 + a->digits[i + k];
+			else l[n] = l[n] * 10;
+	}
+	return(n);
+}
+
+static void multiply_ntt(bignum* a, bignum* b, bignum* c)
+{
+	uint32_t* fa;			/* limbs of a, one row per prime */
+	uint32_t* fb;			/* limbs of b, one row per prime */
+	uint32_t r1, r2, r3, t;
+	uint64_t x, carry;
+	int la, lb, n, i, k, d;
+	const uint64_t p1 = ntt_prime[0], p2 = ntt_prime[1], p3 = ntt_prime[2];
+	const uint64_t p1p2 = p1 * p2;
+	const uint32_t inv_p1 = pow_mod32((uint32_t)(p1 % p2), p2 - 2, (uint32_t)p2);
+	const uint32_t inv_p1p2 = pow_mod32((uint32_t)(p1p2 % p3), p3 - 2, (uint32_t)p3);
+
+	la = a->lastdigit / NTT_LIMB_DIGITS + 1;
+	lb = b->lastdigit / NTT_LIMB_DIGITS + 1;
+	for (n = 1; n < la + lb; n <<= 1);
+
+	fa = calloc(3 * (size_t)n, sizeof(uint32_t));
+	fb = calloc(3 * (size_t)n, sizeof(uint32_t));
+	bignum_to_limbs(a, fa);
+	bignum_to_limbs(b, fb);
+
+	for (k = 0; k < 3; k++) {
+		if (k > 0) {
+			memcpy(fa + (size_t)k * n, fa, sizeof(uint32_t) * la);
+			memcpy(fb + (size_t)k * n, fb, sizeof(uint32_t) * lb);
+		}
+	}
+	for (k = 0; k < 3; k++) {
+		uint32_t* x1 = fa + (size_t)k * n;
+		uint32_t* x2 = fb + (size_t)k * n;
+		ntt(x1, n, ntt_prime[k], 0);
+		ntt(x2, n, ntt_prime[k], 0);
+		for (i = 0; i < n; i++) x1[i] = (uint32_t)((uint64_t)x1[i] * x2[i] % ntt_prime[k]);
+		ntt(x1, n, ntt_prime[k], 1);
+	}
 
 	initialize_bignum(c);
+	carry = 0;
+	d = 0;
+
+	/* Garner: coefficients stay below 2^64, so the last step may wrap */
+	for (i = 0; (i < la + lb) && (d < MAXDIGITS); i++) {
+		r1 = fa[i];
+		r2 = fa[(size_t)n + i];
+		r3 = fa[2 * (size_t)n + i];
+		t = (uint32_t)((r2 + p2 - r1 % p2) % p2 * inv_p1 % p2);
+		x = r1 + p1 * t;
+		t = (uint32_t)((r3 + p3 - x % p3) % p3 * inv_p1p2 % p3);
+		x += p1p2 * t;
+
+		x += carry;
+		carry = x / NTT_LIMB;
+		x = x % NTT_LIMB;
+		for (k = 0; (k < NTT_LIMB_DIGITS) && (d < MAXDIGITS); k++, x /= 10)
+			c->digits[d++] = (char)(x % 10);
+	}
 
-	row = *a;
+	c->lastdigit = d - 1;
+	free(fa);
+	free(fb);
+}
+
+void multiply_bignum(bignum* a, bignum* b, bignum* c)
+{
+	int i, j, k;			/* counters */
+	int t;				/* digit product plus carry */
+	int carry;			/* carry digit */
+
+	if ((a->lastdigit >= NTT_THRESHOLD) && (b->lastdigit >= NTT_THRESHOLD)) {
+		multiply_ntt(a, b, c);
+	}
+	else {
+		initialize_bignum(c);
 
-	for (i = 0; i <= b->lastdigit; i++) {
-		for (j = 1; j <= b->digits[i]; j++) {
-			add_bignum(c, &row, &tmp);
-			*c = tmp;
+		for (i = 0; i <= a->lastdigit; i++) {
+			if (a->digits[i] == 0) continue;
+			carry = 0;
+			for (j = 0; (j <= b->lastdigit) && (i + j < MAXDIGITS); j++) {
+				t = c->digits[i + j] + a->digits[i] * b->digits[j] + carry;
+				c->digits[i + j] = (char)(t % 10);
+				carry = t / 10;
+			}
+			for (k = i + j; carry && (k < MAXDIGITS); k++) {
+				t = c->digits[k] + carry;
+				c->digits[k] = (char)(t % 10);
+				carry = t / 10;
+			}
 		}
-		digit_shift(&row, 1);
+
+		c->lastdigit = a->lastdigit + b->lastdigit + 1;
+		if (c->lastdigit >= MAXDIGITS) c->lastdigit = MAXDIGITS - 1;
 	}
 
 	c->signbit = a->signbit * b->signbit;
@@ -230,3 +409,820 @@ void divide_bignum(bignum* a, bignum* b, bignum* c)
 	a->signbit = asign;
 	b->signbit = bsign;
 }
+
+/*	acc += b, in place when the signs agree	*/
+
+void add_bignum_to(bignum* acc, bignum* b)
+{
+	bignum tmp;			/* mixed signs go through subtract */
+	int carry;			/* carry digit */
+	int last;			/* last digit written */
+	int i;				/* counter */
+
+	if (acc->signbit != b->signbit) {
+		add_bignum(acc, b, &tmp);
+		*acc = tmp;
+		return;
+	}
+
+	last = max(acc->lastdigit, b->lastdigit) + 1;
+	if (last >= MAXDIGITS) last = MAXDIGITS - 1;
+	carry = 0;
+
+	for (i = 0; i <= last; i++) {
+		carry += acc->digits[i] + b->digits[i];
+		acc->digits[i] = (char)(carry % 10);
+		carry /= 10;
+	}
+
+	acc->lastdigit = last;
+	zero_justify(acc);
+}
+
+/*	c = v[0] + ... + v[n-1], summed column by column	*/
+
+void sum_bignums(bignum** v, int n, bignum* c)
+{
+	int col[2][MAXDIGITS];		/* column sums, positive and negative */
+	int last[2] = { 0, 0 };		/* highest column in use */
+	bignum part[2];			/* positive and negative totals */
+	int s, i, k;			/* counters */
+	long carry;
+
+	memset(col, 0, sizeof(col));
+
+	for (k = 0; k < n; k++) {
+		s = (v[k]->signbit == PLUS) ? 0 : 1;
+		for (i = 0; i <= v[k]->lastdigit; i++)
+			col[s][i] += v[k]->digits[i];
+		last[s] = max(last[s], v[k]->lastdigit);
+	}
+
+	for (s = 0; s < 2; s++) {
+		initialize_bignum(&part[s]);
+		carry = 0;
+		for (i = 0; (i < MAXDIGITS) && ((i <= last[s]) || carry); i++) {
+			carry += col[s][i];
+			part[s].digits[i] = (char)(carry % 10);
+			carry /= 10;
+			part[s].lastdigit = i;
+		}
+		zero_justify(&part[s]);
+	}
+
+	subtract_bignum(&part[0], &part[1], c);
+}
+
+/*	c = v[0] * ... * v[n-1], multiplied as a balanced tree	*/
+
+void product_bignums(bignum** v, int n, bignum* c)
+{
+	bignum* w;			/* products of the current level */
+	bignum tmp;			/* placeholder bignum */
+	int m, i;			/* counters */
+
+	if (n == 0) { int_to_bignum(1, c); return; }
+	if (n == 1) { *c = *v[0]; return; }
+
+	m = (n + 1) / 2;
+	w = malloc(sizeof(bignum) * m);
+
+	for (i = 0; i + 1 < n; i += 2)
+		multiply_bignum(v[i], v[i + 1], &w[i / 2]);
+	if (n & 1) w[m - 1] = *v[n - 1];
+
+	while (m > 1) {
+		for (i = 0; i + 1 < m; i += 2) {
+			multiply_bignum(&w[i], &w[i + 1], &tmp);
+			w[i / 2] = tmp;
+		}
+		if (m & 1) w[m / 2] = w[m - 1];
+		m = (m + 1) / 2;
+	}
+
+	*c = w[0];
+	free(w);
+}
+
+/*	bitwise operations work on a binary copy of the magnitude,	*/
+/*	held as little-endian 32-bit words				*/
+
+static int bignum_to_words(bignum* n, uint32_t* w)
+{
+	int i, j;			/* counters */
+	int nw = 0;			/* words in use */
+	uint64_t t;			/* multiply-add carry */
+
+	for (i = n->lastdigit; i >= 0; i--) {
+		t = (uint64_t)n->digits[i];
+		for (j = 0; j < nw; j++) {
+			t += (uint64_t)w[j] * 10;
+			w[j] = (uint32_t)t;
+			t >>= 32;
+		}
+		if (t) w[nw++] = (uint32_t)t;
+	}
+
+	return(nw);
+}
+
+/*	returns -1 if the value does not fit in MAXDIGITS	*/
+
+static int words_to_bignum(uint32_t* w, int nw, int sign, bignum* n)
+{
+	uint32_t q[2 * BNWORDS];	/* quotient being reduced */
+	uint64_t r;			/* remainder of division by 10 */
+	int j;				/* counter */
+
+	initialize_bignum(n);
+
+	while ((nw > 0) && (w[nw - 1] == 0)) nw--;
+	if (nw > 2 * BNWORDS) return(-1);
+	memcpy(q, w, nw * sizeof(uint32_t));
+
+	n->lastdigit = -1;
+	while (nw > 0) {
+		r = 0;
+		for (j = nw - 1; j >= 0; j--) {
+			r = (r << 32) | q[j];
+			q[j] = (uint32_t)(r / 10);
+			r = r % 10;
+		}
+		if (n->lastdigit + 1 >= MAXDIGITS) {
+			initialize_bignum(n);
+			return(-1);
+		}
+		n->digits[++n->lastdigit] = (char)r;
+		while ((nw > 0) && (q[nw - 1] == 0)) nw--;
+	}
+
+	if (n->lastdigit < 0) n->lastdigit = 0;
+	n->signbit = sign;
+	zero_justify(n);
+	return(0);
+}
+
+static void words_decrement(uint32_t* w, int nw)
+{
+	int i;
+
+	for (i = 0; i < nw; i++)
+		if (w[i]-- != 0) break;
+}
+
+static void words_to_twos(uint32_t* w, int nw, int sign, int width)
+{
+	int i;
+
+	for (i = nw; i < width; i++) w[i] = 0;
+	if (sign == PLUS) return;
+
+	for (i = 0; i < width; i++) w[i] = ~w[i];
+	for (i = 0; i < width; i++)
+		if (++w[i] != 0) break;
+}
+
+static int twos_to_words(uint32_t* w, int width)
+{
+	int i;
+
+	if ((w[width - 1] & 0x80000000u) == 0) return(PLUS);
+
+	for (i = 0; i < width; i++) w[i] = ~w[i];
+	for (i = 0; i < width; i++)
+		if (++w[i] != 0) break;
+	return(MINUS);
+}
+
+static void logic_bignum(bignum* a, bignum* b, bignum* c, char op)
+{
+	uint32_t x[BNWORDS + 1], y[BNWORDS + 1];
+	int nx, ny, width, sign, i;
+
+	nx = bignum_to_words(a, x);
+	ny = bignum_to_words(b, y);
+	width = max(nx, ny) + 1;
+
+	words_to_twos(x, nx, a->signbit, width);
+	words_to_twos(y, ny, b->signbit, width);
+
+	for (i = 0; i < width; i++) {
+		switch (op) {
+		case '&': x[i] &= y[i]; break;
+		case '|': x[i] |= y[i]; break;
+		case '^': x[i] ^= y[i]; break;
+		}
+	}
+
+	sign = twos_to_words(x, width);
+	words_to_bignum(x, width, sign, c);
+}
+
+void and_bignum(bignum* a, bignum* b, bignum* c)
+{
+	logic_bignum(a, b, c, '&');
+}
+
+void ior_bignum(bignum* a, bignum* b, bignum* c)
+{
+	logic_bignum(a, b, c, '|');
+}
+
+void xor_bignum(bignum* a, bignum* b, bignum* c)
+{
+	logic_bignum(a, b, c, '^');
+}
+
+/*	c = -a - 1	*/
+
+void not_bignum(bignum* a, bignum* c)
+{
+	bignum one;
+
+	int_to_bignum(1, &one);
+	a->signbit = -1 * a->signbit;
+	subtract_bignum(a, &one, c);
+	a->signbit = -1 * a->signbit;
+	zero_justify(c);
+}
+
+/*	c = floor(a * 2^s), returns -1 on overflow	*/
+
+int ash_bignum(bignum* a, int s, bignum* c)
+{
+	uint32_t w[2 * BNWORDS];	/* shifted magnitude */
+	int nw, ws, bs, i;
+
+	nw = bignum_to_words(a, w);
+
+	if (s >= 0) {
+		ws = s / 32;
+		bs = s % 32;
+		if (nw + ws + 1 > 2 * BNWORDS) return(-1);
+		w[nw] = 0;
+		for (i = nw; i >= 0; i--) {
+			w[i + ws] = (w[i] << bs);
+			if ((bs != 0) && (i > 0)) w[i + ws] |= (w[i - 1] >> (32 - bs));
+		}
+		for (i = 0; i < ws; i++) w[i] = 0;
+		return(words_to_bignum(w, nw + ws + 1, a->signbit, c));
+	}
+
+	/* floor(-m / 2^s) == -((m - 1) >> s) - 1 */
+	s = -s;
+	if (a->signbit == MINUS) words_decrement(w, nw);
+
+	ws = s / 32;
+	bs = s % 32;
+	for (i = 0; i < nw; i++) {
+		if (i + ws >= nw) { w[i] = 0; continue; }
+		w[i] = (w[i + ws] >> bs);
+		if ((bs != 0) && (i + ws + 1 < nw)) w[i] |= (w[i + ws + 1] << (32 - bs));
+	}
+
+	if (a->signbit == MINUS) {
+		for (i = 0; i < nw; i++)
+			if (++w[i] != 0) break;
+		if (i == nw) w[nw++] = 1;
+	}
+
+	return(words_to_bignum(w, nw, a->signbit, c));
+}
+
+/*	set bits of a, or clear bits when a is negative	*/
+
+int logcount_bignum(bignum* a)
+{
+	uint32_t w[BNWORDS];
+	int nw, i, n = 0;
+
+	nw = bignum_to_words(a, w);
+	if (a->signbit == MINUS) words_decrement(w, nw);
+
+	for (i = 0; i < nw; i++) n += popcount32(w[i]);
+	return(n);
+}
+
+/*	bits needed to represent a in two's complement, without sign	*/
+
+int length_bignum(bignum* a)
+{
+	uint32_t w[BNWORDS];
+	int nw;
+
+	nw = bignum_to_words(a, w);
+	if (a->signbit == MINUS) words_decrement(w, nw);
+
+	while ((nw > 0) && (w[nw - 1] == 0)) nw--;
+	if (nw == 0) return(0);
+
+	return(32 * nw - clz32(w[nw - 1]));
+}
+
+/*	xoshiro256** (Blackman and Vigna), seeded through splitmix64	*/
+
+static uint64_t rotl64(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(rng_state* r, uint64_t seed)
+{
+	uint64_t z;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		seed += 0x9e3779b97f4a7c15ULL;
+		z = seed;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		r->s[i] = z ^ (z >> 31);
+	}
+}
+
+uint64_t rng_next(rng_state* r)
+{
+	uint64_t* s = r->s;
+	uint64_t result = rotl64(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl64(s[3], 45);
+
+	return(result);
+}
+
+/*	uniform in [0, n), rejecting the biased low tail	*/
+
+uint64_t rng_below(rng_state* r, uint64_t n)
+{
+	uint64_t x;
+	uint64_t lim = (0 - n) % n;	/* 2^64 mod n */
+
+	do {
+		x = rng_next(r);
+	} while (x < lim);
+
+	return(x % n);
+}
+
+/*	uniform in [0, 2^bits), returns -1 if it can not fit	*/
+
+int random_bignum(rng_state* r, int bits, bignum* n)
+{
+	uint32_t w[2 * BNWORDS];
+	uint64_t x;
+	int nw = (bits + 31) / 32;
+	int i;
+
+	if ((bits < 0) || (nw > 2 * BNWORDS)) return(-1);
+
+	for (i = 0; i < nw; i += 2) {
+		x = rng_next(r);
+		w[i] = (uint32_t)x;
+		if (i + 1 < nw) w[i + 1] = (uint32_t)(x >> 32);
+	}
+	if (bits % 32) w[nw - 1] &= (1u << (bits % 32)) - 1;
+
+	return(words_to_bignum(w, nw, PLUS, n));
+}
+
+/*	returns -1 if n does not fit in an intptr_t	*/
+
+int bignum_to_int(bignum* n, intptr_t* s)
+{
+	intptr_t t = 0;
+	int i;
+
+	for (i = n->lastdigit; i >= 0; i--) {
+		if (t > (INTPTR_MAX - n->digits[i]) / 10) return(-1);
+		t = t * 10 + n->digits[i];
+	}
+
+	*s = n->signbit * t;
+	return(0);
+}
+
+/*	c = a - (a / b) * b, sign follows a	*/
+
+void remainder_bignum(bignum* a, bignum* b, bignum* c)
+{
+	bignum q, p;
+
+	divide_bignum(a, b, &q);
+	multiply_bignum(&q, b, &p);
+	subtract_bignum(a, &p, c);
+}
+
+/*	q = |a| / d, returns |a| % d	*/
+
+static int divide_small(bignum* a, int d, bignum* q)
+{
+	bignum t;
+	int i, r = 0;
+
+	initialize_bignum(&t);
+	t.lastdigit = a->lastdigit;
+
+	for (i = a->lastdigit; i >= 0; i--) {
+		r = r * 10 + a->digits[i];
+		t.digits[i] = (char)(r / d);
+		r = r % d;
+	}
+
+	zero_justify(&t);
+	*q = t;
+	return(r);
+}
+
+/*	modular helpers for primality tests, operands in [0, n)	*/
+
+static void mulmod_bignum(bignum* a, bignum* b, bignum* n, bignum* r)
+{
+	bignum t;
+
+	multiply_bignum(a, b, &t);
+	remainder_bignum(&t, n, r);
+}
+
+static void addmod_bignum(bignum* a, bignum* b, bignum* n, bignum* r)
+{
+	bignum t;
+
+	add_bignum(a, b, &t);
+	if (compare_bignum(&t, n) != PLUS) subtract_bignum(&t, n, r);
+	else *r = t;
+}
+
+static void submod_bignum(bignum* a, bignum* b, bignum* n, bignum* r)
+{
+	bignum t;
+
+	subtract_bignum(a, b, &t);
+	if (t.signbit == MINUS) add_bignum(&t, n, r);
+	else *r = t;
+}
+
+static void halfmod_bignum(bignum* a, bignum* n, bignum* r)
+{
+	bignum t;
+
+	if (a->digits[0] & 1) add_bignum(a, n, &t);
+	else t = *a;
+	divide_small(&t, 2, r);
+}
+
+/*	small int d modulo n, as a value in [0, n)	*/
+
+static void small_mod(int d, bignum* n, bignum* r)
+{
+	bignum t;
+
+	int_to_bignum(d, &t);
+	if (d < 0) add_bignum(&t, n, r);
+	else *r = t;
+}
+
+static int jacobi(long a, long n)
+{
+	long r;
+	int t = 1;
+
+	a %= n;
+	if (a < 0) a += n;
+
+	while (a != 0) {
+		while ((a & 1) == 0) {
+			a >>= 1;
+			r = n % 8;
+			if ((r == 3) || (r == 5)) t = -t;
+		}
+		r = a; a = n; n = r;
+		if (((a % 4) == 3) && ((n % 4) == 3)) t = -t;
+		a %= n;
+	}
+
+	return (n == 1) ? t : 0;
+}
+
+/*	jacobi(d, n) for a small odd d, n odd	*/
+
+static int jacobi_bignum(long d, bignum* n)
+{
+	bignum q;
+	long a = labs(d);
+	int nm4 = divide_small(n, 4, &q);
+	int t = 1;
+
+	if ((d < 0) && (nm4 == 3)) t = -t;
+	if (((a % 4) == 3) && (nm4 == 3)) t = -t;
+
+	return t * jacobi(divide_small(n, (int)a, &q), a);
+}
+
+static int square_bignum(bignum* n)
+{
+	bignum x, y, q, t;
+
+	int_to_bignum(1, &x);
+	digit_shift(&x, n->lastdigit / 2 + 1);	/* x > sqrt(n) */
+
+	for (;;) {
+		divide_bignum(n, &x, &q);
+		add_bignum(&x, &q, &t);
+		divide_small(&t, 2, &y);
+		if (compare_bignum(&y, &x) != PLUS) break;
+		x = y;
+	}
+
+	multiply_bignum(&x, &x, &t);
+	return(compare_bignum(&t, n) == 0);
+}
+
+/*	strong probable prime test to the given base	*/
+
+static int sprp_bignum(bignum* n, int base)
+{
+	bignum nm1, one, x, b;
+	uint32_t w[BNWORDS];
+	int nw, s, i;
+
+	int_to_bignum(1, &one);
+	int_to_bignum(base, &b);
+	subtract_bignum(n, &one, &nm1);
+
+	nw = bignum_to_words(&nm1, w);
+	for (s = 0; ((w[s / 32] >> (s % 32)) & 1) == 0; s++);
+
+	/* x = base^d, d = (n - 1) >> s */
+	x = one;
+	for (i = 32 * nw - 1; i >= s; i--) {
+		mulmod_bignum(&x, &x, n, &x);
+		if ((w[i / 32] >> (i % 32)) & 1) mulmod_bignum(&x, &b, n, &x);
+	}
+
+	if ((compare_bignum(&x, &one) == 0) || (compare_bignum(&x, &nm1) == 0))
+		return(1);
+
+	for (i = 1; i < s; i++) {
+		mulmod_bignum(&x, &x, n, &x);
+		if (compare_bignum(&x, &nm1) == 0) return(1);
+		if (compare_bignum(&x, &one) == 0) return(0);
+	}
+
+	return(0);
+}
+
+/*	strong Lucas probable prime test, Selfridge parameters	*/
+
+static int lucas_bignum(bignum* n)
+{
+	bignum np1, one, dm, qm, qk, u, v, t;
+	uint32_t w[BNWORDS];
+	long d = 5;
+	int nw, s, i, j;
+
+	for (i = 0;; i++) {
+		j = jacobi_bignum(d, n);
+		if (j == -1) break;
+		if (j == 0) return(0);
+		if ((i == 10) && square_bignum(n)) return(0);
+		d = (d > 0) ? -(d + 2) : -(d - 2);
+	}
+
+	/* P = 1, Q = (1 - D) / 4 */
+	small_mod((int)d, n, &dm);
+	small_mod((int)((1 - d) / 4), n, &qm);
+
+	int_to_bignum(1, &one);
+	add_bignum(n, &one, &np1);
+	nw = bignum_to_words(&np1, w);
+	for (s = 0; ((w[s / 32] >> (s % 32)) & 1) == 0; s++);
+
+	/* U_1 = 1, V_1 = P, walk the bits of d = (n + 1) >> s */
+	for (i = 32 * nw - 1; !((w[i / 32] >> (i % 32)) & 1); i--);
+	u = one;
+	v = one;
+	qk = qm;
+
+	for (i--; i >= s; i--) {
+		mulmod_bignum(&u, &v, n, &u);
+		mulmod_bignum(&v, &v, n, &v);
+		submod_bignum(&v, &qk, n, &v);
+		submod_bignum(&v, &qk, n, &v);
+		mulmod_bignum(&qk, &qk, n, &qk);
+
+		if ((w[i / 32] >> (i % 32)) & 1) {
+			addmod_bignum(&u, &v, n, &t);
+			mulmod_bignum(&dm, &u, n, &u);
+			addmod_bignum(&u, &v, n, &v);
+			halfmod_bignum(&t, n, &u);
+			halfmod_bignum(&v, n, &v);
+			mulmod_bignum(&qk, &qm, n, &qk);
+		}
+	}
+
+	if ((u.lastdigit == 0 && u.digits[0] == 0) ||
+		(v.lastdigit == 0 && v.digits[0] == 0)) return(1);
+
+	for (i = 1; i < s; i++) {
+		mulmod_bignum(&v, &v, n, &v);
+		submod_bignum(&v, &qk, n, &v);
+		submod_bignum(&v, &qk, n, &v);
+		if (v.lastdigit == 0 && v.digits[0] == 0) return(1);
+		mulmod_bignum(&qk, &qk, n, &qk);
+	}
+
+	return(0);
+}
+
+/*	Baillie-PSW: trial division, base 2 strong test, strong Lucas	*/
+/*	returns -1 if n is too long to square within MAXDIGITS		*/
+
+int prime_bignum(bignum* n)
+{
+	static const int small[] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41,
+		43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97 };
+	bignum q;
+	int i;
+
+	if (n->lastdigit + 2 > MAXDIGITS / 2) return(-1);
+	if (n->signbit == MINUS) return(0);
+
+	for (i = 0; i < (int)(sizeof(small) / sizeof(small[0])); i++) {
+		int_to_bignum(small[i], &q);
+		if (compare_bignum(n, &q) == 0) return(1);
+		if (divide_small(n, small[i], &q) == 0) return(0);
+	}
+
+	int_to_bignum(97 * 97, &q);
+	if (compare_bignum(n, &q) == PLUS)
+		return(n->lastdigit > 0 || n->digits[0] > 1);
+
+	return(sprp_bignum(n, 2) && lucas_bignum(n));
+}
+
+/*	c = smallest prime greater than a, -1 if out of range	*/
+
+int next_prime_bignum(bignum* a, bignum* c)
+{
+	bignum t, two;
+	int p;
+
+	int_to_bignum(2, &two);
+	if (compare_bignum(a, &two) == PLUS) {
+		*c = two;
+		return(0);
+	}
+
+	if (a->digits[0] & 1) add_bignum(a, &two, c);
+	else {
+		int_to_bignum(1, &t);
+		add_bignum(a, &t, c);
+	}
+
+	while ((p = prime_bignum(c)) == 0)
+		add_bignum_to(c, &two);
+
+	return (p < 0) ? -1 : 0;
+}
+
+/*	radix conversion, power of two radices slice the binary words	*/
+
+static const char radix_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+static int radix_value(char c)
+{
+	if ((c >= '0') && (c <= '9')) return(c - '0');
+	if ((c >= 'a') && (c <= 'z')) return(c - 'a' + 10);
+	if ((c >= 'A') && (c <= 'Z')) return(c - 'A' + 10);
+	return(99);
+}
+
+static int radix_bits(int radix)
+{
+	int b = 0;
+
+	if (radix & (radix - 1)) return(0);
+	while ((1 << b) < radix) b++;
+	return(b);
+}
+
+/*	s must hold BNCHARS, returns the string length	*/
+
+int bignum_to_string(bignum* n, int radix, char* s)
+{
+	uint32_t w[BNWORDS];		/* binary magnitude */
+	uint64_t r;			/* remainder of division by radix */
+	int nw, bits, nbits, i, j, k = 0;
+	char tmp;
+
+	if (n->signbit == MINUS) s[k++] = '-';
+
+	if (radix == 10) {
+		for (i = n->lastdigit; i >= 0; i--)
+			s[k++] = (char)('0' + n->digits[i]);
+		s[k] = '\0';
+		return(k);
+	}
+
+	nw = bignum_to_words(n, w);
+	i = k;
+
+	if ((bits = radix_bits(radix)) != 0) {
+		nbits = 32 * nw;
+		for (j = 0; j < nbits; j += bits) {
+			r = w[j / 32] >> (j % 32);
+			if ((j % 32) + bits > 32 && (j / 32) + 1 < nw)
+				r |= (uint64_t)w[j / 32 + 1] << (32 - (j % 32));
+			s[k++] = radix_digits[r & (radix - 1)];
+		}
+	}
+	else {
+		while (nw > 0) {
+			r = 0;
+			for (j = nw - 1; j >= 0; j--) {
+				r = (r << 32) | w[j];
+				w[j] = (uint32_t)(r / radix);
+				r = r % radix;
+			}
+			s[k++] = radix_digits[r];
+			while ((nw > 0) && (w[nw - 1] == 0)) nw--;
+		}
+	}
+
+	/* digits came out low first, drop leading zeros and reverse */
+	while ((k > i + 1) && (s[k - 1] == '0')) k--;
+	if (k == i) s[k++] = '0';
+	for (j = k - 1; i < j; i++, j--) {
+		tmp = s[i]; s[i] = s[j]; s[j] = tmp;
+	}
+	s[k] = '\0';
+	return(k);
+}
+
+/*	returns -1 on a bad digit or if the value does not fit	*/
+
+int string_to_bignum(const char* s, int radix, bignum* n)
+{
+	uint32_t w[2 * BNWORDS];
+	uint64_t t;
+	int sign = PLUS, nw = 0, bits, len, d, i, j;
+	const char* p;
+
+	if ((*s == '-') || (*s == '+')) {
+		if (*s == '-') sign = MINUS;
+		s++;
+	}
+	len = (int)strlen(s);
+	if (len == 0) return(-1);
+
+	for (p = s; *p; p++)
+		if (radix_value(*p) >= radix) return(-1);
+
+	if (radix == 10) {
+		while ((len > 1) && (*s == '0')) { s++; len--; }
+		if (len > MAXDIGITS) return(-1);
+		initialize_bignum(n);
+		n->lastdigit = len - 1;
+		for (i = 0; i < len; i++)
+			n->digits[len - 1 - i] = (char)(s[i] - '0');
+		n->signbit = sign;
+		zero_justify(n);
+		return(0);
+	}
+
+	if ((bits = radix_bits(radix)) != 0) {
+		if ((len * bits + 31) / 32 > 2 * BNWORDS) return(-1);
+		memset(w, 0, sizeof(w));
+		for (i = 0; i < len; i++) {
+			d = radix_value(s[len - 1 - i]);
+			j = i * bits;
+			w[j / 32] |= (uint32_t)d << (j % 32);
+			if ((j % 32) + bits > 32)
+				w[j / 32 + 1] |= (uint32_t)d >> (32 - (j % 32));
+		}
+		nw = (len * bits + 31) / 32;
+	}
+	else {
+		for (p = s; *p; p++) {
+			t = (uint64_t)radix_value(*p);
+			for (j = 0; j < nw; j++) {
+				t += (uint64_t)w[j] * radix;
+				w[j] = (uint32_t)t;
+				t >>= 32;
+			}
+			if (t) {
+				if (nw == 2 * BNWORDS) return(-1);
+				w[nw++] = (uint32_t)t;
+			}
+		}
+	}
+
+	return(words_to_bignum(w, nw, sign, n));
+}
@@ -5,9 +5,8 @@
 
 #define LVER 3.0 /* in the form x.y */
 
-//#define HT 
-#define MAXENV 2000
-#define MAXPACK 50
+/* Bindings an env keeps inline before switching to a hash table */
+#define ENVINLINE 8
 
 #include <stdio.h>
 #include <math.h>
@@ -17,41 +16,45 @@
 //#include <mimalloc-override.h>
 #endif
 #include "mpc.h"
-#ifdef HT
 #include "ht.h"
-#endif
 
 #include "longint.h"
+#include "thpool.h"
 
 struct lval;
 struct lenv;
 struct pack;
+struct memo;
+struct lmap;
+struct lvec;
+struct lic;
+struct lfut;
+struct lchan;
 typedef struct lval lval;
 typedef struct lenv lenv;
 typedef struct pack pack;
-
-mpc_parser_t* Number;
-mpc_parser_t* NumbI;
-mpc_parser_t* NumbF;
-mpc_parser_t* NumbL;
-mpc_parser_t* Symbol;
-mpc_parser_t* String;
-mpc_parser_t* Comment;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* Lispy;
-
-
+typedef struct memo memo;
+typedef struct lmap lmap;
+typedef struct lvec lvec;
+typedef struct lic lic;
+typedef struct lfut lfut;
+typedef struct lchan lchan;
 
 /* lval types */
 enum {
     LVAL_ERR = 0, LVAL_INUM, LVAL_DNUM, LVAL_SYM,
-    LVAL_BNUM, LVAL_STR, LVAL_SEXPR, LVAL_FUN, LVAL_QEXPR
+    LVAL_BNUM, LVAL_STR, LVAL_SEXPR, LVAL_FUN, LVAL_QEXPR,
+    LVAL_MAP, LVAL_VEC, LVAL_FUT, LVAL_CHAN
 };
 
 typedef lval* (*lbuiltin)(lenv*, lval*);
 
+/* A builtin and the name it is bound to */
+typedef struct lbuiltin_def {
+    char* name;
+    lbuiltin func;
+} lbuiltin_def;
+
 #define LASSERT(args, cond, fmt, ...) \
   if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
 
@@ -74,6 +77,19 @@ typedef lval* (*lbuiltin)(lenv*, lval*);
   LASSERT(args, args->cell[index]->count != 0, \
     "Function '%s' passed {} for argument %i.", func, index);
 
+/* Globals are shared by every task of a parallel builtin. Outside of a
+   task, the futures still running are waited for first */
+#define LASSERT_SERIAL(func, args) \
+  lpar_quiesce(); \
+  LASSERT(args, !lctx->parent, \
+    "Function '%s' cannot change globals inside a parallel task.", func)
+
+/* Parallel tasks running in the process, see lpar_for. While there are
+   any, the reference counts of shared values change atomically */
+extern volatile long lparallel;
+#define LREF_INC(r) (th_atomic_load(&lparallel) ? th_atomic_add(&(r), 1) : ++(r))
+#define LREF_DEC(r) (th_atomic_load(&lparallel) ? th_atomic_add(&(r), -1) : --(r))
+
 typedef struct lval {
     int type;         /* 0 */
     intptr_t inum;        /* 1 */
@@ -81,37 +97,226 @@ typedef struct lval {
     /* Error and Symbol types have some string data */
     char* err;
     char* sym;        /* 4 */
+    pack* pkg;        /* package current when the symbol was read */
     char* str;        /* 5 */
     /* Functions */
     lbuiltin builtin; /* 6 (FFI?) */
+    memo* memo;       /* result cache of a memoized function */
 
     bignum bnum;     /* 7 */
 
+    lmap* map;        /* shared hash map */
+    lvec* vec;        /* shared growable array */
+    lfut* fut;        /* shared future, see par.c */
+    lchan* chan;      /* shared channel, see chan.c */
+
     lenv* env;
     lval* formals;
     lval* body;
     /* Count and Pointer to a list of "lval*"; */
     int count;
     struct lval** cell;
+    lic* ic;          /* call site cache of a list headed by a symbol */
 } lval;
 
-/* TODO: implement pacakges */
+/* Default number of results kept by memoize */
+#define MEMOCAP 1024
+
+/* Cached call, on a hash chain and on the LRU list */
+typedef struct memo_entry {
+    uint64_t hash;
+    lval* args;
+    lval* val;
+    struct memo_entry* next;  /* same bucket */
+    struct memo_entry* newer; /* LRU neighbours */
+    struct memo_entry* older;
+} memo_entry;
+
+/* Shared by every copy of a memoized function */
+struct memo {
+    lval* fn;
+    long refs;
+    int capacity;
+    int count;
+    long hits;
+    long misses;
+    int nbuckets;
+    memo_entry** buckets;
+    memo_entry* newest;
+    memo_entry* oldest;
+};
+
+/* Hash map keyed by any lval, copies of a map lval share it */
+struct lmap {
+    hto* table;
+    long refs;
+};
+
+/* Contiguous array of lvals, copies of a vector lval share it */
+struct lvec {
+    lval** items;
+    int count;
+    int capacity;
+    long refs;
+};
+
+/* Inline cache of a call site's global function, shared by every copy
+   of the list. The cached binding is used while version matches
+   ic_version, which changes whenever a global is rebound or a name is
+   first bound locally */
+struct lic {
+    char* sym;
+    pack* pkg;
+    lval* val;
+    long version;
+    long refs;
+};
+
+/* A package owns the envs created while it is current, kept on an
+   intrusive list so registering and removing one is O(1) */
 struct pack {
-    lenv* env[2000];
     char* name;
-    int pcount;
-    int ecount;
-    pack* plist[50];
+    pack* parent;
+    pack* children;   /* sub-packages, linked through next/prev */
+    pack* next;
+    pack* prev;
+    int pcount;       /* number of sub-packages */
+    lenv* envs;       /* live envs, linked through pnext/pprev */
+    long ecount;      /* live envs */
+    long epeak;       /* most envs live at once */
+    long etotal;      /* envs ever registered */
+    lenv* env;        /* the package's own global bindings, hashed */
+    ht* imports;      /* name -> package it was imported from */
 };
 
+/* True for the global env of a package, rootenv included */
+#define LENV_GLOBAL(e) ((e)->pack->env == (e))
+
 struct lenv {
     lenv* par;
-    int count;
-#ifdef HT
-    ht* h1;
+    lenv* closure;             /* partial application bindings, searched
+                                  after this env's own */
+    ht* h1;                    /* every binding, once count > ENVINLINE */
+    int count;                 /* number of bindings */
+    long refs;                 /* functions sharing this env */
+    char* syms[ENVINLINE];     /* small frames scan these */
+    lval* vals[ENVINLINE];
+    pack* pack;                /* owner, and links in its env list */
+    lenv* pnext;
+    lenv* pprev;
+};
+
+typedef struct lispy_ctx lispy_ctx;
+
+/* Everything one interpreter owns. Several can live in a process, each
+   used by one thread at a time */
+struct lispy_ctx {
+    pack* rootpack;   /* root of the packages, see IN-PACKAGE */
+    pack* currpack;
+    lenv* rootenv;    /* global env of the root package */
+    long ic_version;  /* state behind the call site caches */
+    ht* shadowed;     /* names ever bound outside a package env */
+    long gensym;
+    rng_state rng;    /* see seed-random */
+    int cache;        /* use .lspc source caches, cleared by --no-cache */
+    lispy_ctx* parent; /* interpreter a parallel task was cloned from */
+    ht* pending;      /* names a task bound locally first, see lpar_for */
+    volatile long live; /* work left by futures made from it */
+};
+
+/* True while other threads may be reading the interpreter's state: in a
+   task, or with futures of it still about */
+#define LSHARED(c) ((c)->parent || th_atomic_load(&(c)->live))
+
+#ifdef _MSC_VER
+#define LTHREAD __declspec(thread)
 #else
-    char** syms;
-    lval** vals;
+#define LTHREAD _Thread_local
 #endif
-};
+
+/* The interpreter the calling thread is running */
+extern LTHREAD lispy_ctx* lctx;
+
+/* A fresh interpreter with an empty root package, and its teardown */
+lispy_ctx* lctx_new(void);
+void lctx_del(lispy_ctx* c);
+
+/* Constructors the reader builds lvals with */
+lval* lval_inum(intptr_t x);
+lval* lval_dnum(double x);
+lval* lval_err(char* fmt, ...);
+lval* lval_sym(char* s);
+lval* lval_str(char* s);
+lval* lval_sexpr(void);
+lval* lval_qexpr(void);
+lval* lval_add(lval* v, lval* x);
+void lval_del(lval* v);
+lval* builtin_make_map(lenv* e, lval* a);
+lval* builtin_copy(lenv* e, lval* a);
+int lval_holds(lval* x, void* c);
+lval* builtin_list_to_vec(lenv* e, lval* a);
+lic* lic_new(void);
+pack* pack_find(char* n);
+
+/* Builtins and constructors an image is rebuilt with */
+extern lbuiltin_def lbuiltins[];
+extern int lbuiltins_count;
+lval* lval_builtin(lbuiltin func);
+lval* lval_bnum(bignum b);
+lval* lval_map(void);
+lval* lval_vec(int n);
+void lmap_put(lmap* m, lval* k, lval* v);
+void lvec_push(lvec* v, lval* x);
+memo* memo_new(lval* fn, int capacity);
+lenv* lenv_new(void);
+void lenv_put(lenv* e, lval* k, lval* v);
+pack* pack_new(char* n);
+
+/* Evaluator entry points the embedding API drives */
+lval* lval_eval(lenv* e, lval* v);
+lval* lval_call(lenv* e, lval* f, lval* a);
+lval* lval_copy(lval* v);
+lval* lval_take(lval* v, int i);
+lval* lval_pop(lval* v, int i);
+lval* lenv_get(lenv* e, lval* k);
+void lenv_def(lenv* e, lval* k, lval* v);
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
+void lenv_add_builtins(lenv* e);
+lval* builtin_load(lenv* e, lval* a);
+char* ltype_name(int t);
+
+/* Used by the parallel builtins */
+lval* lval_item(lenv* e, lval* l, int i);
+lval* lenv_local(lenv* e, lval* k);
+void lenv_del(lenv* e);
+void lenv_release(lenv* e);
+lval* builtin_eval(lenv* e, lval* a);
+lval* lval_call1(lenv* e, lval* f, lval* x);
+lval* lval_call2(lenv* e, lval* f, lval* x, lval* y);
+int lval_truthy(lval* x);
+lval* builtin_lt(lenv* e, lval* a);
+lval* builtin_le(lenv* e, lval* a);
+lval* builtin_gt(lenv* e, lval* a);
+lval* builtin_ge(lenv* e, lval* a);
+
+/* Serialise a task's update of state shared with other tasks. Outside
+   of tasks these do nothing */
+void lpar_lock(void);
+void lpar_unlock(void);
+
+/* Wait for the futures of the current interpreter, before its globals
+   change. Does nothing in a task */
+void lpar_quiesce(void);
+
+/* Futures shared by copies of an lval */
+void lfut_retain(lfut* f);
+void lfut_release(lfut* f);
+
+/* Value of a future, waiting for it if need be */
+lval* lfut_value(lfut* f);
+
+/* Channels shared by copies of an lval, and by interpreters */
+lval* lval_chan(lchan* c);
+void lchan_retain(lchan* c);
+void lchan_release(lchan* c);
 #endif
\ No newline at end of file
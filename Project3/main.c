@@ -1,6 +1,11 @@
 #include "lsp.h"
+#include "reader.h"
+#include "image.h"
+#include "par.h"
+#include "chan.h"
 #include <varargs.h>
 #include <time.h>
+#include <limits.h>
 
 #ifdef _WIN32
 
@@ -22,16 +27,8 @@ void add_history(char* unused) {}
 #include <editline/history.h>
 #endif
 
-int gensym = 0;
-
-bignum BZERO;
-
-/* Simple package implementation */
-/* Global vars to simulate the IN-PACKAGE */
-/* and the USE-PACKAGE commands */
-pack* rootpack = NULL;
-pack* currpack = NULL;
-pack** packlist = NULL;
+/* Interpreter of the calling thread */
+LTHREAD lispy_ctx* lctx = NULL;
 
 /* Construct a pointer to a new Number lval */
 lval* lval_inum(intptr_t x) {
@@ -52,8 +49,7 @@ lval* lval_dnum(double x) {
 lval* lval_bnum(bignum b) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_BNUM;
-    initialize_bignum(&v->bnum); /* init to 0 */
-    add_bignum(&b, &BZERO, &v->bnum);
+    v->bnum = b;
     return v;
 }
 
@@ -86,6 +82,7 @@ lval* lval_sym(char* s) {
     v->type = LVAL_SYM;
     v->sym = malloc(strlen(s) + 1);
     strcpy(v->sym, s);
+    v->pkg = lctx->currpack;
     return v;
 }
 
@@ -95,6 +92,7 @@ lval* lval_sexpr(void) {
     v->type = LVAL_SEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->ic = NULL;
     return v;
 }
 
@@ -104,6 +102,35 @@ lval* lval_qexpr(void) {
     v->type = LVAL_QEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->ic = NULL;
+    return v;
+}
+
+int lval_eq(lval* x, lval* y);
+
+bool lval_key_eq(const void* a, const void* b) {
+    return lval_eq((lval*)a, (lval*)b);
+}
+
+/* A pointer to a new empty Map lval */
+lval* lval_map(void) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_MAP;
+    v->map = malloc(sizeof(lmap));
+    v->map->table = hto_create(lval_key_eq);
+    v->map->refs = 1;
+    return v;
+}
+
+/* A pointer to a new Vector lval with room for n items */
+lval* lval_vec(int n) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_VEC;
+    v->vec = malloc(sizeof(lvec));
+    v->vec->capacity = n > 4 ? n : 4;
+    v->vec->items = malloc(sizeof(lval*) * v->vec->capacity);
+    v->vec->count = 0;
+    v->vec->refs = 1;
     return v;
 }
 
@@ -111,6 +138,7 @@ lval* lval_builtin(lbuiltin func) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_FUN;
     v->builtin = func;
+    v->memo = NULL;
     return v;
 }
 
@@ -124,131 +152,202 @@ lval* lval_str(char* s) {
 
 void pack_envadd(pack* p, lenv* e);
 
-lenv* lenv_new(void) {
+/* A new empty env registered with package p */
+lenv* lenv_alloc(pack* p) {
     lenv* e = malloc(sizeof(lenv));
     e->par = NULL;
     e->count = 0;
-#ifdef HT
-    e->h1 = ht_create();
-#else
-    e->syms = NULL;
-    e->vals = NULL;
-#endif
-    pack_envadd(currpack, e);
+    e->refs = 1;
+    e->h1 = NULL;
+    e->closure = NULL;
+    pack_envadd(p, e);
     return e;
 }
 
-/* create the root package */
-pack* pack_init(void) {
+lenv* lenv_new(void) {
+    return lenv_alloc(lctx->currpack);
+}
+
+void lenv_hash(lenv* e);
+
+pack* pack_alloc(char* name) {
     pack* p = malloc(sizeof(pack));
-    p->pcount = 0; /* this is the number of packages in the root */
+    p->name = malloc(strlen(name) + 1);
+    strcpy(p->name, name);
+    p->parent = NULL;
+    p->children = NULL;
+    p->next = NULL;
+    p->prev = NULL;
+    p->pcount = 0;
+    p->envs = NULL;
     p->ecount = 0;
-    p->name = ":LSPY";
-    p->env[0] = NULL;
-    p->plist[0] = NULL;
-    rootpack = p;
-    currpack = p;
+    p->epeak = 0;
+    p->etotal = 0;
+    p->imports = NULL;
+    p->env = lenv_alloc(p);
+    lenv_hash(p->env);
     return p;
 }
 
-/* add a new package to the root */
-pack* pack_new(char *n) {
-    if (rootpack->pcount > MAXPACK) {
-        fprintf(stderr, "E100");
-        exit(-100);
-    }
-    pack* pn = malloc(sizeof(pack));
-    pn->ecount = 0; /* this is the number of envs in the package */
-    pn->pcount = 0;
-    pn->name = n;
-    pn->env[0] = NULL;
-    pn->plist[pn->pcount] = NULL; /* no sub-packages */
-    return pn;
+/* create the root package */
+pack* pack_init(void) {
+    pack* p = pack_alloc(":LSPY");
+    lctx->rootpack = p;
+    lctx->currpack = p;
+    return p;
 }
 
-pack* pack_copy(pack* e) {
-    pack* n = malloc(sizeof(pack));
-    n->ecount = e->ecount; /* this is the number of envs in the package */
-    n->pcount = e->pcount;
-    n->name = e->name;
-    for (int i = 0; i < n->ecount; i++)
-        n->env[i] = e->env[i];
-    n->plist[n->pcount] = NULL; /* no sub-packages */
-    return n;
+lispy_ctx* lctx_new(void) {
+    lispy_ctx* c = malloc(sizeof(lispy_ctx));
+    c->currpack = NULL;
+    c->ic_version = 1;
+    c->shadowed = NULL;
+    c->gensym = 0;
+    c->cache = 1;
+    c->parent = NULL;
+    c->pending = NULL;
+    c->live = 0;
+    rng_seed(&c->rng, (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)c);
+
+    /* The root package registers its env with the current interpreter */
+    lispy_ctx* saved = lctx;
+    lctx = c;
+    c->rootpack = pack_init(); /* create the root elem for packages */
+    c->rootenv = c->rootpack->env;
+    lctx = saved;
+    return c;
+}
+
+static void pack_free(pack* p) {
+    if (p->imports) { ht_destroy(p->imports); }
+    free(p->name);
+    free(p);
+}
+
+/* Drop every package env, which takes the values bound in them along,
+   then the packages themselves */
+void lctx_del(lispy_ctx* c) {
+    lispy_ctx* saved = lctx;
+    lctx = c;
+    lpar_quiesce();
+    for (pack* p = c->rootpack->children; p; p = p->next) { lenv_del(p->env); }
+    lenv_del(c->rootpack->env);
+    pack* p = c->rootpack->children;
+    while (p) {
+        pack* n = p->next;
+        pack_free(p);
+        p = n;
+    }
+    pack_free(c->rootpack);
+    if (c->shadowed) { ht_destroy(c->shadowed); }
+    free(c);
+    lctx = saved == c ? NULL : saved;
 }
 
-/* add a reference to an environment to a specific package */
-void pack_envadd(pack* p, lenv* e) {
-    
-    if (p->ecount > MAXENV) {
-        fprintf(stderr, "E200");
-        exit(-200);
-    }
-    p->env[p->ecount] = e; /* reference directly the memory address */
-                           /* do not want a copy */
-    p->ecount++;
+/* add a new package to the root */
+pack* pack_new(char *n) {
+    pack* pn = pack_alloc(n);
+    pn->parent = lctx->rootpack;
+    pn->next = lctx->rootpack->children;
+    if (pn->next) { pn->next->prev = pn; }
+    lctx->rootpack->children = pn;
+    lctx->rootpack->pcount++;
+    return pn;
 }
 
-/* add a reference to an environment to a specific package */
-int pack_envdel(pack* p, lenv* e) {
-    int i = 0;
-    while (i <= p->ecount) {
-        if (p->env[i] == e) break;
-        i++;
+/* find a package by name, the root included */
+pack* pack_find(char* n) {
+    if (strcmp(lctx->rootpack->name, n) == 0) { return lctx->rootpack; }
+    for (pack* p = lctx->rootpack->children; p; p = p->next) {
+        if (strcmp(p->name, n) == 0) { return p; }
     }
-    if (i > p->ecount) { return -1; }; /* temp env not added to package */
+    return NULL;
+}
 
-    p->env[i] = NULL;
+/* add an environment to a specific package */
+void pack_envadd(pack* p, lenv* e) {
+    e->pack = p;
+
+    /* Tasks leave the shared list alone, their envs link to themselves */
+    if (LSHARED(lctx)) {
+        e->pnext = e->pprev = e;
+        return;
+    }
+    e->pprev = NULL;
+    e->pnext = p->envs;
+    if (e->pnext) { e->pnext->pprev = e; }
+    p->envs = e;
+
+    p->etotal++;
+    if (++p->ecount > p->epeak) { p->epeak = p->ecount; }
+}
+
+/* remove an environment from the package that owns it */
+void pack_envdel(lenv* e) {
+    pack* p = e->pack;
+    if (e->pprev == e) { return; }
+    lpar_lock();
+    if (e->pprev) { e->pprev->pnext = e->pnext; }
+    else { p->envs = e->pnext; }
+    if (e->pnext) { e->pnext->pprev = e->pprev; }
     p->ecount--;
-    if (p->ecount < 0) {
-        fprintf(stderr, "E210");
-        exit(-210);
-    }
-    return i;
+    lpar_unlock();
 }
  
 void lval_del(lval* v);
+void lenv_release(lenv* e);
 
 void lenv_del(lenv* e) {
-#ifdef HT
-    ht_destroy(e->h1);
-#else
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+    if (e->h1) {
+        /* The table frees its keys, the values are ours */
+        hti it = ht_iterator(e->h1);
+        while (ht_next(&it)) {
+            lval_del(it.value);
+        }
+        ht_destroy(e->h1);
     }
-    pack_envdel(currpack, e);
-    free(e->syms);
-    free(e->vals);
-#endif
+    else {
+        for (int i = 0; i < e->count; i++) {
+            free(e->syms[i]);
+            lval_del(e->vals[i]);
+        }
+    }
+    if (e->closure) { lenv_release(e->closure); }
+    pack_envdel(e);
     free(e);
 }
 
+/* Drop a reference to the shared env of a function */
+void lenv_release(lenv* e) {
+    if (LREF_DEC(e->refs) == 0) { lenv_del(e); }
+}
+
 lval* lval_copy(lval* v);
 
 lenv* lenv_copy(lenv* e) {
     lenv* n = malloc(sizeof(lenv));
     n->par = e->par;
     n->count = e->count;
-#ifdef HT
-    n->h1 = ht_create();
-#else
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-#endif
-
-#ifdef HT
-    hti ite = ht_iterator(e->h1);
-    while (ht_next(&ite)) {
-        ht_set(n->h1, ite.key, lval_copy(ite.value));
+    n->refs = 1;
+    n->h1 = NULL;
+    n->closure = e->closure;
+    if (n->closure) { LREF_INC(n->closure->refs); }
+    pack_envadd(lctx->currpack, n);
+
+    if (e->h1) {
+        n->h1 = ht_create();
+        hti ite = ht_iterator(e->h1);
+        while (ht_next(&ite)) {
+            ht_set(n->h1, ite.key, lval_copy(ite.value));
+        }
     }
-#else
-    for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+    else {
+        for (int i = 0; i < e->count; i++) {
+            n->syms[i] = malloc(strlen(e->syms[i]) + 1);
+            strcpy(n->syms[i], e->syms[i]);
+            n->vals[i] = lval_copy(e->vals[i]);
+        }
     }
-#endif
     return n;
 }
 
@@ -258,6 +357,7 @@ lval* lval_lambda(lval* formals, lval* body) {
 
     /* Set Builtin to Null */
     v->builtin = NULL;
+    v->memo = NULL;
 
     /* Build new environment */
     v->env = lenv_new();
@@ -268,6 +368,11 @@ lval* lval_lambda(lval* formals, lval* body) {
     return v;
 }
 
+void memo_release(memo* m);
+void lic_release(lic* c);
+void lmap_release(lmap* m);
+void lvec_release(lvec* m);
+
 void lval_del(lval* v) {
 
     switch (v->type) {
@@ -275,8 +380,11 @@ void lval_del(lval* v) {
     case LVAL_INUM: break;
     case LVAL_DNUM: break;
     case LVAL_FUN:
-        if (!v->builtin) {
-            lenv_del(v->env);
+        if (v->memo) {
+            memo_release(v->memo);
+        }
+        else if (!v->builtin) {
+            lenv_release(v->env);
             lval_del(v->formals);
             lval_del(v->body);
         }
@@ -286,6 +394,10 @@ void lval_del(lval* v) {
     case LVAL_ERR: free(v->err); break;
     case LVAL_SYM: free(v->sym); break;
     case LVAL_STR: free(v->str); break;
+    case LVAL_MAP: lmap_release(v->map); break;
+    case LVAL_VEC: lvec_release(v->vec); break;
+    case LVAL_FUT: lfut_release(v->fut); break;
+    case LVAL_CHAN: lchan_release(v->chan); break;
 
         /* If Sexpr then delete all elements inside */
     case LVAL_QEXPR:
@@ -295,6 +407,7 @@ void lval_del(lval* v) {
         }
         /* Also free the memory allocated to contain the pointers */
         free(v->cell);
+        if (v->ic) { lic_release(v->ic); }
         break;
     }
 
@@ -340,19 +453,26 @@ lval* lval_copy(lval* v) {
 
         /* Copy Functions and Numbers Directly */
     case LVAL_FUN:
-        if (v->builtin) {
+        x->memo = v->memo;
+        if (v->memo) {
+            x->builtin = NULL;
+            LREF_INC(v->memo->refs);
+        }
+        else if (v->builtin) {
             x->builtin = v->builtin;
         }
         else {
             x->builtin = NULL;
-            x->env = lenv_copy(v->env);
+            /* The env is never written once built, so share it */
+            x->env = v->env;
+            LREF_INC(x->env->refs);
             x->formals = lval_copy(v->formals);
             x->body = lval_copy(v->body);
         }
         break;
     case LVAL_INUM: x->inum = v->inum; break;
     case LVAL_DNUM: x->dnum = v->dnum; break;
-    case LVAL_BNUM: add_bignum(&v->bnum, &BZERO, &x->bnum); break;
+    case LVAL_BNUM: x->bnum = v->bnum; break;
 
         /* Copy Strings using malloc and strcpy */
     case LVAL_ERR:
@@ -361,12 +481,33 @@ lval* lval_copy(lval* v) {
 
     case LVAL_SYM:
         x->sym = malloc(strlen(v->sym) + 1);
-        strcpy(x->sym, v->sym); break;
+        strcpy(x->sym, v->sym);
+        x->pkg = v->pkg;
+        break;
 
     case LVAL_STR: 
         x->str = malloc(strlen(v->str) + 1);
         strcpy(x->str, v->str);
         break;
+
+        /* Maps are shared, not copied */
+    case LVAL_MAP:
+        x->map = v->map;
+        LREF_INC(x->map->refs);
+        break;
+    case LVAL_VEC:
+        x->vec = v->vec;
+        LREF_INC(x->vec->refs);
+        break;
+    case LVAL_FUT:
+        x->fut = v->fut;
+        lfut_retain(x->fut);
+        break;
+    case LVAL_CHAN:
+        x->chan = v->chan;
+        lchan_retain(x->chan);
+        break;
+
         /* Copy Lists by copying each sub-expression */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
@@ -375,40 +516,142 @@ lval* lval_copy(lval* v) {
         for (int i = 0; i < x->count; i++) {
             x->cell[i] = lval_copy(v->cell[i]);
         }
+        x->ic = v->ic;
+        if (x->ic) { LREF_INC(x->ic->refs); }
         break;
     }
 
     return x;
 }
 
-lval* lenv_get(lenv* e, lval* k) {
-#ifdef HT
+/* A copy of v sharing no map or vector with it */
+lval* lval_copy_deep(lval* v) {
     lval* x;
-
-    if ((x = ht_get(e->h1, k->sym)) != NULL) {
-        return lval_copy(x);
+    switch (v->type) {
+    case LVAL_MAP: {
+        x = lval_map();
+        htoi it = hto_iterator(v->map->table);
+        while (hto_next(&it)) {
+            lmap_put(x->map, lval_copy_deep((lval*)it.key), lval_copy_deep(it.value));
+        }
+        return x;
     }
-#else
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+    case LVAL_VEC:
+        x = lval_vec(v->vec->count);
+        for (int i = 0; i < v->vec->count; i++) {
+            x->vec->items[i] = lval_copy_deep(v->vec->items[i]);
+        }
+        x->vec->count = v->vec->count;
+        return x;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        x = malloc(sizeof(lval));
+        x->type = v->type;
+        x->count = v->count;
+        x->cell = malloc(sizeof(lval*) * x->count);
+        for (int i = 0; i < x->count; i++) {
+            x->cell[i] = lval_copy_deep(v->cell[i]);
         }
+        x->ic = v->ic;
+        if (x->ic) { LREF_INC(x->ic->refs); }
+        return x;
     }
-#endif
+    return lval_copy(v);
+}
 
-    /* If no symbol check in parent otherwise error */
-    if (e->par) {
-        return lenv_get(e->par, k);
+/* The value bound to sym in e itself, not a copy */
+lval* lenv_peek(lenv* e, char* sym) {
+    if (e->h1) { return ht_get(e->h1, sym); }
+    for (int i = 0; i < e->count; i++) {
+        if (strcmp(e->syms[i], sym) == 0) { return e->vals[i]; }
     }
-    else {
-        return lval_err("Unbound Symbol '%s'", k->sym);
+    return NULL;
+}
+
+/* The name k is bound under in its package, past any "pkg:" prefix.
+   The root package's own name starts with ':', as in ":LSPY:sym" */
+char* lsym_name(lval* k) {
+    char* c = strchr(k->sym + (k->sym[0] == ':'), ':');
+    return (c && c[1]) ? c + 1 : k->sym;
+}
+
+/* The global binding of k as seen from the package it was read in:
+   that package's own table, then its imports, then the root */
+lval* lenv_global(lval* k) {
+    char* name = lsym_name(k);
+    pack* p = k->pkg ? k->pkg : lctx->rootpack;
+    lval* x = lenv_peek(p->env, name);
+    if (x) { return x; }
+
+    pack* from = p->imports ? ht_get(p->imports, name) : NULL;
+    if (from && (x = lenv_peek(from->env, name))) { return x; }
+
+    return p != lctx->rootpack ? lenv_peek(lctx->rootpack->env, name) : NULL;
+}
+
+/* The binding of k in e or the envs it reads through to, short of the
+   globals. NULL if there is none */
+lval* lenv_local(lenv* e, lval* k) {
+    /* Check each local env up to the root */
+    for (; e && e != lctx->rootenv; e = e->par) {
+        /* A frame's own bindings, then those of its partial application */
+        for (lenv* b = e; b; b = b->closure) {
+            lval* x = lenv_peek(b, k->sym);
+            if (x) { return x; }
+        }
+    }
+    return NULL;
+}
+
+lval* lenv_get(lenv* e, lval* k) {
+    lval* x = lenv_local(e, k);
+    if (x) { return lval_copy(x); }
+
+    /* Then the globals, otherwise error */
+    x = lenv_global(k);
+    if (x) { return lval_copy(x); }
+    return lval_err("Unbound Symbol '%s'", k->sym);
+}
+
+/* Move the inline bindings of e into a new hash table */
+void lenv_hash(lenv* e) {
+    e->h1 = ht_create();
+    for (int i = 0; i < e->count; i++) {
+        ht_set(e->h1, e->syms[i], e->vals[i]);
+        free(e->syms[i]);
     }
 }
 
 void lenv_put(lenv* e, lval* k, lval* v) {
-#ifdef HT
+    /* A name bound locally can no longer be cached at call sites */
+    if (!LENV_GLOBAL(e) && !(lctx->shadowed && ht_get(lctx->shadowed, k->sym))) {
+        if (LSHARED(lctx)) {
+            /* Tasks share the table, theirs is added when they end */
+            if (!lctx->pending) { lctx->pending = ht_create(); }
+            ht_set(lctx->pending, k->sym, lctx->pending);
+        }
+        else {
+            if (!lctx->shadowed) { lctx->shadowed = ht_create(); }
+            ht_set(lctx->shadowed, k->sym, lctx->shadowed);
+            lctx->ic_version++;
+        }
+    }
+
+    if (e->h1) {
+        lval* old = ht_get(e->h1, k->sym);
         ht_set(e->h1, k->sym, lval_copy(v));
-#else
+        if (old) {
+            if (LENV_GLOBAL(e)) { lctx->ic_version++; }
+            lval_del(old);
+        }
+        else {
+            /* A package global may hide one cached from the root */
+            if (LENV_GLOBAL(e) && e != lctx->rootenv) { lctx->ic_version++; }
+            e->count++;
+        }
+        return;
+    }
+
     /* Iterate over all items in environment */
     /* This is to see if variable already exists */
     for (int i = 0; i < e->count; i++) {
@@ -416,123 +659,186 @@ void lenv_put(lenv* e, lval* k, lval* v) {
         /* If variable is found delete item at that position */
         /* And replace with variable supplied by user */
         if (strcmp(e->syms[i], k->sym) == 0) {
+            if (LENV_GLOBAL(e)) { lctx->ic_version++; }
             lval_del(e->vals[i]);
             e->vals[i] = lval_copy(v);
             return;
         }
     }
 
-    /* If no existing entry found allocate space for new entry */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    /* No room left inline so switch to a hash table */
+    if (e->count == ENVINLINE) {
+        lenv_hash(e);
+        ht_set(e->h1, k->sym, lval_copy(v));
+        e->count++;
+        return;
+    }
 
     /* Copy contents of lval and symbol string into new location */
-    e->vals[e->count - 1] = lval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count - 1], k->sym);
-#endif
+    e->vals[e->count] = lval_copy(v);
+    e->syms[e->count] = malloc(strlen(k->sym) + 1);
+    strcpy(e->syms[e->count], k->sym);
+    e->count++;
 }
 
 void lenv_def(lenv* e, lval* k, lval* v) {
-    /* Iterate till e has no parent */
-    while (e->par) { e = e->par; }
-    /* Put value in e */
-    lenv_put(e, k, v);
+    lpar_quiesce();
+
+    /* Globals go to the table of the symbol's package */
+    pack* p = k->pkg ? k->pkg : lctx->rootpack;
+    lval name = *k;
+    name.sym = lsym_name(k);
+    lenv_put(p->env, &name, v);
 }
 
 lval* builtin_eval(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
 
+lval* memo_call(lenv* e, memo* m, lval* a);
+
+/* Bind everything bound in src into e */
+void lenv_merge(lenv* e, lenv* src) {
+    lval k;
+    k.type = LVAL_SYM;
+    if (src->h1) {
+        hti it = ht_iterator(src->h1);
+        while (ht_next(&it)) {
+            k.sym = (char*)it.key;
+            lenv_put(e, &k, it.value);
+        }
+    }
+    else {
+        for (int i = 0; i < src->count; i++) {
+            k.sym = src->syms[i];
+            lenv_put(e, &k, src->vals[i]);
+        }
+    }
+}
+
+/* A new call frame reading through to the bindings in closure */
+lenv* lenv_frame(lenv* closure) {
+    lenv* e = malloc(sizeof(lenv));
+    e->par = NULL;
+    e->count = 0;
+    e->refs = 1;
+    e->h1 = NULL;
+    e->closure = NULL;
+    if (closure->count) {
+        e->closure = closure;
+        LREF_INC(closure->refs);
+    }
+    pack_envadd(lctx->currpack, e);
+    return e;
+}
+
+/* Call f on a. f is left untouched: arguments are bound into a fresh
+   frame that reads through to the bindings of a partial application */
 lval* lval_call(lenv* e, lval* f, lval* a) {
 
     /* If Builtin then simply apply that */
     if (f->builtin) { return f->builtin(e, a); }
+    if (f->memo) { return memo_call(e, f->memo, a); }
 
     /* Record Argument Counts */
     int given = a->count;
     int total = f->formals->count;
+    lval** formals = f->formals->cell;
+    int bound = 0;
+
+    lenv* frame = lenv_frame(f->env);
 
     /* While arguments still remain to be processed */
     while (a->count) {
 
         /* If we've ran out of formal arguments to bind */
-        if (f->formals->count == 0) {
+        if (bound == total) {
+            lenv_del(frame);
             lval_del(a);
             return lval_err("Function passed too many arguments. "
                 "Got %i, Expected %i.", given, total);
         }
 
-        /* Pop the first symbol from the formals */
-        lval* sym = lval_pop(f->formals, 0);
+        /* Take the next symbol from the formals */
+        lval* sym = formals[bound++];
 
         /* Special Case to deal with '&' */
         if (strcmp(sym->sym, "&") == 0) {
 
             /* Ensure '&' is followed by another symbol */
-            if (f->formals->count != 1) {
+            if (total - bound != 1) {
+                lenv_del(frame);
                 lval_del(a);
                 return lval_err("Function format invalid. "
                     "Symbol '&' not followed by single symbol.");
             }
 
             /* Next formal should be bound to remaining arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
+            lenv_put(frame, formals[bound++], builtin_list(e, a));
             break;
         }
 
         /* Pop the next argument from the list */
         lval* val = lval_pop(a, 0);
 
-        /* Bind a copy into the function's environment */
-        lenv_put(f->env, sym, val);
-
-        /* Delete symbol and value */
-        lval_del(sym); lval_del(val);
+        /* Bind a copy into the frame */
+        lenv_put(frame, sym, val);
+        lval_del(val);
     }
 
     /* Argument list is now bound so can be cleaned up */
     lval_del(a);
 
     /* If '&' remains in formal list bind to empty list */
-    if (f->formals->count > 0 &&
-        strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    if (bound < total && strcmp(formals[bound]->sym, "&") == 0) {
 
         /* Check to ensure that & is not passed invalidly. */
-        if (f->formals->count != 2) {
+        if (total - bound != 2) {
+            lenv_del(frame);
             return lval_err("Function format invalid. "
                 "Symbol '&' not followed by single symbol.");
         }
 
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(f->formals, 0));
-
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
+        /* Bind the symbol after '&' to an empty list */
         lval* val = lval_qexpr();
-
-        /* Bind to environment and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
+        lenv_put(frame, formals[bound + 1], val);
+        lval_del(val);
+        bound += 2;
     }
 
     /* If all formals have been bound evaluate */
-    if (f->formals->count == 0) {
+    if (bound == total) {
 
         /* Set environment parent to evaluation environment */
-        f->env->par = e;
+        frame->par = e;
 
         /* Evaluate and return */
-        return builtin_eval(f->env,
+        lval* r = builtin_eval(frame,
             lval_add(lval_sexpr(), lval_copy(f->body)));
+        lenv_del(frame);
+        return r;
     }
-    else {
-        /* Otherwise return partially evaluated function */
-        return lval_copy(f);
+
+    /* Otherwise return a partially applied function, its env holding
+       the earlier bindings with this call's on top */
+    lval* rest = lval_qexpr();
+    for (int i = bound; i < total; i++) {
+        lval_add(rest, lval_copy(formals[i]));
     }
+    lval* p = lval_lambda(rest, lval_copy(f->body));
+    lenv_release(p->env);
+    p->env = lenv_copy(f->env);
+    lenv_merge(p->env, frame);
+    lenv_del(frame);
+    return p;
+}
+
+/* Call f with one or two arguments, taking ownership of them */
+lval* lval_call1(lenv* e, lval* f, lval* x) {
+    return lval_call(e, f, lval_add(lval_sexpr(), x));
+}
 
+lval* lval_call2(lenv* e, lval* f, lval* x, lval* y) {
+    return lval_call(e, f, lval_add(lval_add(lval_sexpr(), x), y));
 }
 
 void lval_print(lval* v);
@@ -553,6 +859,30 @@ void lval_expr_print(lval* v, char open, char close) {
     putchar(close);
 }
 
+void lval_map_print(lval* v) {
+    int first = 1;
+    htoi it = hto_iterator(v->map->table);
+
+    printf("#{");
+    while (hto_next(&it)) {
+        if (!first) { putchar(' '); }
+        lval_print((lval*)it.key);
+        putchar(' ');
+        lval_print((lval*)it.value);
+        first = 0;
+    }
+    putchar('}');
+}
+
+void lval_vec_print(lval* v) {
+    printf("#[");
+    for (int i = 0; i < v->vec->count; i++) {
+        if (i) { putchar(' '); }
+        lval_print(v->vec->items[i]);
+    }
+    putchar(']');
+}
+
 void lval_print_str(lval* v) {
     /* Make a Copy of the string */
     char* escaped = malloc(strlen(v->str) + 1);
@@ -575,10 +905,25 @@ void lval_print(lval* v) {
     case LVAL_ERR:   printf("Error: %s", v->err); break;
     case LVAL_SYM:   printf("%s", v->sym); break;
     case LVAL_STR:   lval_print_str(v); break;
-    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
+    case LVAL_SEXPR:
+        /* A literal read as (copy #{...}) prints as it was written */
+        if (v->count == 2 && v->cell[0]->type == LVAL_FUN &&
+            v->cell[0]->builtin == builtin_copy &&
+            (v->cell[1]->type == LVAL_MAP || v->cell[1]->type == LVAL_VEC)) {
+            lval_print(v->cell[1]);
+        }
+        else { lval_expr_print(v, '(', ')'); }
+        break;
     case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+    case LVAL_MAP:   lval_map_print(v); break;
+    case LVAL_VEC:   lval_vec_print(v); break;
+    case LVAL_FUT:   printf("<future>"); break;
+    case LVAL_CHAN:  printf("<channel>"); break;
     case LVAL_FUN:
-        if (v->builtin) {
+        if (v->memo) {
+            printf("<memo "); lval_print(v->memo->fn); putchar('>');
+        }
+        else if (v->builtin) {
             printf("<builtin@%p>",v->builtin);
         }
         else {
@@ -602,6 +947,10 @@ char* ltype_name(int t) {
     case LVAL_STR: return "String";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_MAP: return "Map";
+    case LVAL_VEC: return "Vector";
+    case LVAL_FUT: return "Future";
+    case LVAL_CHAN: return "Channel";
     default: return "Unknown";
     }
 }
@@ -674,8 +1023,13 @@ int lval_eq(lval* x, lval* y) {
     case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
     case LVAL_STR: return (strcmp(x->str, y->str) == 0);
 
+    case LVAL_BNUM: return compare_bignum(&x->bnum, &y->bnum) == 0;
+
         /* If builtin compare, otherwise compare formals and body */
     case LVAL_FUN:
+        if (x->memo || y->memo) {
+            return x->memo && y->memo && lval_eq(x->memo->fn, y->memo->fn);
+        }
         if (x->builtin || y->builtin) {
             return x->builtin == y->builtin;
         }
@@ -695,10 +1049,276 @@ int lval_eq(lval* x, lval* y) {
         /* Otherwise lists must be equal */
         return 1;
         break;
+
+        /* Maps are equal if they hold the same keys and values */
+    case LVAL_MAP:
+        if (x->map == y->map) { return 1; }
+        if (hto_length(x->map->table) != hto_length(y->map->table)) { return 0; }
+        htoi it = hto_iterator(x->map->table);
+        while (hto_next(&it)) {
+            lval* yv = hto_get(y->map->table, it.hash, it.key);
+            if (!yv || !lval_eq(it.value, yv)) { return 0; }
+        }
+        return 1;
+
+    case LVAL_VEC:
+        if (x->vec == y->vec) { return 1; }
+        if (x->vec->count != y->vec->count) { return 0; }
+        for (int i = 0; i < x->vec->count; i++) {
+            if (!lval_eq(x->vec->items[i], y->vec->items[i])) { return 0; }
+        }
+        return 1;
+
+        /* Futures are only equal to themselves */
+    case LVAL_FUT: return x->fut == y->fut;
+    case LVAL_CHAN: return x->chan == y->chan;
     }
     return 0;
 }
 
+#define HASH_OFFSET 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+uint64_t hash_mix(uint64_t h, uint64_t x) {
+    h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h * HASH_PRIME;
+}
+
+uint64_t hash_str(char* s) {
+    uint64_t h = HASH_OFFSET;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= HASH_PRIME;
+    }
+    return h;
+}
+
+/* Structural hash, equal values under lval_eq hash the same */
+uint64_t lval_hash(lval* v) {
+    uint64_t h = hash_mix(HASH_OFFSET, (uint64_t)v->type);
+    double d;
+
+    switch (v->type) {
+    case LVAL_INUM:
+    case LVAL_DNUM:
+        /* lval_eq compares these as doubles */
+        d = (v->type == LVAL_INUM) ? (double)v->inum : v->dnum;
+        if (d == 0.0) { d = 0.0; } /* -0.0 == 0.0 */
+        /* Casting NaN, infinities or anything past int64_t is undefined */
+        if (isfinite(d) && d >= -9223372036854775808.0 && d < 9223372036854775808.0 &&
+            d == (double)(int64_t)d) {
+            return hash_mix(h, (uint64_t)(int64_t)d);
+        }
+        else {
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return hash_mix(h, bits);
+        }
+    case LVAL_BNUM:
+        h = hash_mix(h, (uint64_t)(int64_t)v->bnum.signbit);
+        for (int i = 0; i <= v->bnum.lastdigit; i++) {
+            h = hash_mix(h, (uint64_t)v->bnum.digits[i]);
+        }
+        return h;
+    case LVAL_ERR: return hash_mix(h, hash_str(v->err));
+    case LVAL_SYM: return hash_mix(h, hash_str(v->sym));
+    case LVAL_STR: return hash_mix(h, hash_str(v->str));
+    case LVAL_FUN:
+        if (v->memo) {
+            return hash_mix(h + 1, lval_hash(v->memo->fn));
+        }
+        if (v->builtin) {
+            return hash_mix(h, (uint64_t)(uintptr_t)v->builtin);
+        }
+        return hash_mix(lval_hash(v->formals), lval_hash(v->body));
+    case LVAL_QEXPR:
+    case LVAL_SEXPR:
+        for (int i = 0; i < v->count; i++) {
+            h = hash_mix(h, lval_hash(v->cell[i]));
+        }
+        return h;
+    case LVAL_MAP:
+        {
+            /* Independent of the order entries are stored in */
+            uint64_t sum = 0;
+            htoi it = hto_iterator(v->map->table);
+            while (hto_next(&it)) {
+                sum += hash_mix(it.hash, lval_hash(it.value));
+            }
+            return hash_mix(h, sum);
+        }
+    case LVAL_VEC:
+        for (int i = 0; i < v->vec->count; i++) {
+            h = hash_mix(h, lval_hash(v->vec->items[i]));
+        }
+        return h;
+    case LVAL_FUT: return hash_mix(h, (uint64_t)(uintptr_t)v->fut);
+    case LVAL_CHAN: return hash_mix(h, (uint64_t)(uintptr_t)v->chan);
+    }
+    return h;
+}
+
+memo* memo_new(lval* fn, int capacity) {
+    memo* m = malloc(sizeof(memo));
+    m->fn = fn;
+    m->refs = 1;
+    m->capacity = capacity;
+    m->count = 0;
+    m->hits = 0;
+    m->misses = 0;
+    m->nbuckets = 16;
+    m->buckets = calloc(m->nbuckets, sizeof(memo_entry*));
+    m->newest = NULL;
+    m->oldest = NULL;
+    return m;
+}
+
+void memo_entry_del(memo_entry* x) {
+    lval_del(x->args);
+    lval_del(x->val);
+    free(x);
+}
+
+void memo_release(memo* m) {
+    if (LREF_DEC(m->refs) > 0) { return; }
+    memo_entry* x = m->newest;
+    while (x) {
+        memo_entry* n = x->older;
+        memo_entry_del(x);
+        x = n;
+    }
+    lval_del(m->fn);
+    free(m->buckets);
+    free(m);
+}
+
+void memo_unlink(memo* m, memo_entry* x) {
+    if (x->newer) { x->newer->older = x->older; } else { m->newest = x->older; }
+    if (x->older) { x->older->newer = x->newer; } else { m->oldest = x->newer; }
+}
+
+void memo_push(memo* m, memo_entry* x) {
+    x->newer = NULL;
+    x->older = m->newest;
+    if (m->newest) { m->newest->newer = x; } else { m->oldest = x; }
+    m->newest = x;
+}
+
+/* Drop the least recently used entry */
+void memo_evict(memo* m) {
+    memo_entry* x = m->oldest;
+    memo_entry** p = &m->buckets[x->hash & (m->nbuckets - 1)];
+    while (*p != x) { p = &(*p)->next; }
+    *p = x->next;
+    memo_unlink(m, x);
+    memo_entry_del(x);
+    m->count--;
+}
+
+void memo_grow(memo* m) {
+    int n = m->nbuckets * 2;
+    memo_entry** b = calloc(n, sizeof(memo_entry*));
+    for (int i = 0; i < m->nbuckets; i++) {
+        memo_entry* x = m->buckets[i];
+        while (x) {
+            memo_entry* next = x->next;
+            x->next = b[x->hash & (n - 1)];
+            b[x->hash & (n - 1)] = x;
+            x = next;
+        }
+    }
+    free(m->buckets);
+    m->buckets = b;
+    m->nbuckets = n;
+}
+
+lval* memo_call(lenv* e, memo* m, lval* a) {
+    uint64_t h = hash_mix(HASH_OFFSET, (uint64_t)a->count);
+    for (int i = 0; i < a->count; i++) {
+        h = hash_mix(h, lval_hash(a->cell[i]));
+    }
+
+    lpar_lock();
+    for (memo_entry* x = m->buckets[h & (m->nbuckets - 1)]; x; x = x->next) {
+        if (x->hash == h && lval_eq(x->args, a)) {
+            m->hits++;
+            memo_unlink(m, x);
+            memo_push(m, x);
+            lval* r = lval_copy(x->val);
+            lpar_unlock();
+            lval_del(a);
+            return r;
+        }
+    }
+    m->misses++;
+    lpar_unlock();
+
+    /* The call may re-enter this cache, so hold our own references */
+    LREF_INC(m->refs);
+    lval* args = lval_copy(a);
+    lval* r = lval_call(e, m->fn, a);
+
+    if (r->type == LVAL_ERR || m->capacity == 0) {
+        lval_del(args);
+        memo_release(m);
+        return r;
+    }
+
+    lpar_lock();
+    memo_entry* x = malloc(sizeof(memo_entry));
+    x->hash = h;
+    x->args = args;
+    x->val = lval_copy(r);
+    x->next = m->buckets[h & (m->nbuckets - 1)];
+    m->buckets[h & (m->nbuckets - 1)] = x;
+    memo_push(m, x);
+    m->count++;
+
+    if (m->count > m->capacity) { memo_evict(m); }
+    if (m->count > m->nbuckets) { memo_grow(m); }
+    lpar_unlock();
+
+    memo_release(m);
+    return r;
+}
+
+void lmap_release(lmap* m) {
+    if (LREF_DEC(m->refs) > 0) { return; }
+    htoi it = hto_iterator(m->table);
+    while (hto_next(&it)) {
+        lval_del((lval*)it.key);
+        lval_del(it.value);
+    }
+    hto_destroy(m->table);
+    free(m);
+}
+
+/* Bind k to v, taking ownership of both */
+void lmap_put(lmap* m, lval* k, lval* v) {
+    void* old;
+    const void* kept = hto_set(m->table, lval_hash(k), k, v, &old);
+    if (kept != k) { lval_del(k); }
+    if (old) { lval_del(old); }
+}
+
+void lvec_release(lvec* v) {
+    if (LREF_DEC(v->refs) > 0) { return; }
+    for (int i = 0; i < v->count; i++) {
+        lval_del(v->items[i]);
+    }
+    free(v->items);
+    free(v);
+}
+
+/* Append x to v, taking ownership of it */
+void lvec_push(lvec* v, lval* x) {
+    if (v->count == v->capacity) {
+        v->capacity *= 2;
+        v->items = realloc(v->items, sizeof(lval*) * v->capacity);
+    }
+    v->items[v->count++] = x;
+}
+
 lval* builtin_join(lenv* e, lval* a) {
 
     for (int i = 0; i < a->count; i++) {
@@ -914,160 +1534,329 @@ lval* builtin_mod(lenv* e, lval* a) {
     return builtin_op(e, a, "%");
 }
 
-lval* builtin_addb(lenv* e, lval* a) {
-    lval* r;
-    bignum b, c, tmp;
-
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
-
-    if (x->type == LVAL_INUM)
-        int_to_bignum(x->inum, &b);
-    else
-        add_bignum(&x->bnum,&BZERO,&b);
+/* Point at the BIGNUM of every argument without copying it. */
+/* Integers are widened into 'w', which the caller frees. */
+bignum** lval_bignum_args(lval* a, bignum** w) {
+    int n = 0;
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type == LVAL_INUM) n++;
+    }
 
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+    bignum** v = malloc(sizeof(bignum*) * a->count);
+    *w = n ? malloc(sizeof(bignum) * n) : NULL;
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
+    n = 0;
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type == LVAL_INUM) {
+            int_to_bignum(a->cell[i]->inum, &(*w)[n]);
+            v[i] = &(*w)[n++];
+        }
+        else {
+            v[i] = &a->cell[i]->bnum;
+        }
+    }
+    return v;
+}
 
-        if (y->type == LVAL_INUM)
-            int_to_bignum(y->inum, &c);
-        else
-            add_bignum(&y->bnum,&BZERO,&c);
+lval* builtin_opb(lenv* e, lval* a, char* op) {
+    LASSERT(a, a->count > 0,
+        "Function '%s' passed no arguments.", op);
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE2(op, a, i, LVAL_INUM, LVAL_BNUM);
+    }
 
-        add_bignum(&b, &c, &tmp);
-        add_bignum(&tmp, &BZERO, &b);
+    bignum *w, r, tmp;
+    bignum** v = lval_bignum_args(a, &w);
 
-        lval_del(y);
+    if (strcmp(op, "addb") == 0) {
+        sum_bignums(v, a->count, &r);
+    }
+    if (strcmp(op, "subb") == 0) {
+        sum_bignums(v + 1, a->count - 1, &tmp);
+        subtract_bignum(v[0], &tmp, &r);
+    }
+    if (strcmp(op, "mulb") == 0) {
+        product_bignums(v, a->count, &r);
+    }
+    if (strcmp(op, "divb") == 0) {
+        r = *v[0];
+        for (int i = 1; i < a->count; i++) {
+            if (v[i]->lastdigit == 0 && v[i]->digits[0] == 0) {
+                free(v); free(w); lval_del(a);
+                return lval_err("Division By Zero.");
+            }
+            divide_bignum(&r, v[i], &tmp);
+            r = tmp;
+        }
     }
 
-    lval_del(a); 
-    r = lval_bnum(b);
-    return r;
+    free(v);
+    free(w);
+    lval_del(a);
+    return lval_bnum(r);
 }
 
-lval* builtin_subb(lenv* e, lval* a) {
-    lval* r;
-    bignum b, c, tmp;
-
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
-
-    if (x->type == LVAL_INUM)
-        int_to_bignum(x->inum, &b);
-    else
-        add_bignum(&x->bnum, &BZERO, &b);
-
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+lval* builtin_addb(lenv* e, lval* a) {
+    return builtin_opb(e, a, "addb");
+}
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
+lval* builtin_subb(lenv* e, lval* a) {
+    return builtin_opb(e, a, "subb");
+}
 
-        if (y->type == LVAL_INUM)
-            int_to_bignum(y->inum, &c);
-        else
-            add_bignum(&y->bnum, &BZERO, &c);
+lval* builtin_mulb(lenv* e, lval* a) {
+    return builtin_opb(e, a, "mulb");
+}
 
-        subtract_bignum(&b, &c, &tmp);
-        add_bignum(&tmp, &BZERO, &b);
+lval* builtin_divb(lenv* e, lval* a) {
+    return builtin_opb(e, a, "divb");
+}
 
-        lval_del(y);
-    }
+lval* builtin_i_to_bnum(lenv* e, lval* a) {
+    LASSERT_NUM("to-bnum", a, 1);
+    LASSERT_TYPE("to-bnum", a, 0, LVAL_INUM);
+    bignum b;
 
-    lval_del(a); 
-    r = lval_bnum(b);
-    return r;
+    int_to_bignum(a->cell[0]->inum, &b);
+    lval_del(a);
+    return lval_bnum(b);
 }
 
-lval* builtin_mulb(lenv* e, lval* a) {
-    lval* r;
-    bignum b, c, tmp;
+/* 0 == eq, 1 == a < b, -1 == a > b */
+lval* builtin_cmp_bnum(lenv* e, lval* a) {
+    LASSERT_NUM("cmp-bnum", a, 2);
+    LASSERT_TYPE("cmp-bnum", a, 0, LVAL_BNUM);
+    LASSERT_TYPE("cmp-bnum", a, 1, LVAL_BNUM);
+    int v;
 
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
+    v = compare_bignum(&a->cell[0]->bnum, &a->cell[1]->bnum);
+    return lval_inum(v);
+}
 
+void lval_to_bignum(lval* x, bignum* b) {
     if (x->type == LVAL_INUM)
-        int_to_bignum(x->inum, &b);
+        int_to_bignum(x->inum, b);
     else
-        add_bignum(&x->bnum, &BZERO, &b);
-
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+        *b = x->bnum;
+}
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
+/* Bitwise operations, result is a BIGNUM if any argument is one */
+lval* builtin_logop(lenv* e, lval* a, char* op) {
+    short is_bop = 0;
+    bignum b, c, tmp;
 
-        if (y->type == LVAL_INUM)
-            int_to_bignum(y->inum, &c);
-        else
-            add_bignum(&y->bnum, &BZERO, &c);
+    LASSERT(a, a->count > 0,
+        "Function '%s' passed no arguments.", op);
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE2(op, a, i, LVAL_INUM, LVAL_BNUM);
+        if (a->cell[i]->type == LVAL_BNUM) is_bop = 1;
+    }
 
-        multiply_bignum(&b, &c, &tmp);
-        add_bignum(&tmp, &BZERO, &b);
+    if (!is_bop) {
+        intptr_t r = a->cell[0]->inum;
+        for (int i = 1; i < a->count; i++) {
+            if (strcmp(op, "logand") == 0) r &= a->cell[i]->inum;
+            if (strcmp(op, "logior") == 0) r |= a->cell[i]->inum;
+            if (strcmp(op, "logxor") == 0) r ^= a->cell[i]->inum;
+        }
+        lval_del(a);
+        return lval_inum(r);
+    }
 
-        lval_del(y);
+    lval_to_bignum(a->cell[0], &b);
+    for (int i = 1; i < a->count; i++) {
+        lval_to_bignum(a->cell[i], &c);
+        if (strcmp(op, "logand") == 0) and_bignum(&b, &c, &tmp);
+        if (strcmp(op, "logior") == 0) ior_bignum(&b, &c, &tmp);
+        if (strcmp(op, "logxor") == 0) xor_bignum(&b, &c, &tmp);
+        b = tmp;
     }
 
-    lval_del(a); 
-    r = lval_bnum(b);
-    return r;
+    lval_del(a);
+    return lval_bnum(b);
 }
 
-lval* builtin_divb(lenv* e, lval* a) {
-    lval* r;
-    bignum b, c, tmp;
+lval* builtin_logand(lenv* e, lval* a) {
+    return builtin_logop(e, a, "logand");
+}
 
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
+lval* builtin_logior(lenv* e, lval* a) {
+    return builtin_logop(e, a, "logior");
+}
 
-    if (x->type == LVAL_INUM)
-        int_to_bignum(x->inum, &b);
-    else
-        add_bignum(&x->bnum, &BZERO, &b);
+lval* builtin_logxor(lenv* e, lval* a) {
+    return builtin_logop(e, a, "logxor");
+}
 
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+lval* builtin_lognot(lenv* e, lval* a) {
+    LASSERT_NUM("lognot", a, 1);
+    LASSERT_TYPE2("lognot", a, 0, LVAL_INUM, LVAL_BNUM);
+    lval* x = lval_take(a, 0);
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
+    if (x->type == LVAL_INUM) {
+        x->inum = ~x->inum;
+    }
+    else {
+        bignum c;
+        not_bignum(&x->bnum, &c);
+        x->bnum = c;
+    }
+    return x;
+}
 
-        if (y->type == LVAL_INUM)
-            int_to_bignum(y->inum, &c);
-        else
-            add_bignum(&y->bnum, &BZERO, &c);
+/* (ash x n) - shift x left by n bits, or right (flooring) if n < 0 */
+lval* builtin_ash(lenv* e, lval* a) {
+    LASSERT_NUM("ash", a, 2);
+    LASSERT_TYPE2("ash", a, 0, LVAL_INUM, LVAL_BNUM);
+    LASSERT_TYPE("ash", a, 1, LVAL_INUM);
 
-        divide_bignum(&b, &c, &tmp);
-        add_bignum(&tmp, &BZERO, &b);
+    intptr_t s = a->cell[1]->inum;
+    int bits = (int)(sizeof(intptr_t) * 8);
+    lval* x = a->cell[0];
 
-        lval_del(y);
+    if (x->type == LVAL_INUM) {
+        intptr_t r;
+        if (s <= -bits) {
+            r = (x->inum < 0) ? -1 : 0;
+        }
+        else if (s < 0) {
+            r = x->inum >> -s;
+        }
+        else if (s < bits - 1 && x->inum <= (INTPTR_MAX >> s) && x->inum >= (INTPTR_MIN >> s)) {
+            /* Shifting a negative number left is undefined, shift the bits */
+            r = (intptr_t)((uintptr_t)x->inum << s);
+        }
+        else {
+            /* Does not fit, promote to BIGNUM */
+            goto bignum_shift;
+        }
+        lval_del(a);
+        return lval_inum(r);
     }
 
-    lval_del(a); 
-    r = lval_bnum(b);
-    return r;
+bignum_shift:;
+    bignum b, c;
+    lval_to_bignum(x, &b);
+    /* Zero stays zero however far it moves, and no bignum has
+       MAXDIGITS * 4 bits, so a shift that far right leaves 0 or -1 */
+    int zero = b.lastdigit == 0 && b.digits[0] == 0;
+    if (zero || s <= -MAXDIGITS * 4) {
+        lval_del(a);
+        return lval_inum(!zero && b.signbit == MINUS ? -1 : 0);
+    }
+    LASSERT(a, s < MAXDIGITS * 4,
+        "Function 'ash' shift count out of range.");
+    if (ash_bignum(&b, (int)s, &c) != 0) {
+        lval_del(a);
+        return lval_err("BIGNUM overflow.");
+    }
+    lval_del(a);
+    return lval_bnum(c);
 }
 
-lval* builtin_i_to_bnum(lenv* e, lval* a) {
-    LASSERT_NUM("to-bnum", a, 1);
-    LASSERT_TYPE("to-bnum", a, 0, LVAL_INUM);
-    lval* x = lval_bnum(BZERO);
+lval* builtin_popcount(lenv* e, lval* a) {
+    LASSERT_NUM("popcount", a, 1);
+    LASSERT_TYPE2("popcount", a, 0, LVAL_INUM, LVAL_BNUM);
+    int n;
 
-    int_to_bignum(a->cell[0]->inum, &x->bnum);
-    return x;
+    if (a->cell[0]->type == LVAL_INUM) {
+        intptr_t x = a->cell[0]->inum;
+        uint64_t u = (uint64_t)(x < 0 ? ~x : x);
+        n = popcount32((uint32_t)u) + popcount32((uint32_t)(u >> 32));
+    }
+    else {
+        n = logcount_bignum(&a->cell[0]->bnum);
+    }
+    lval_del(a);
+    return lval_inum(n);
 }
 
-/* 0 == eq, 1 == a < b, -1 == a > b */
-lval* builtin_cmp_bnum(lenv* e, lval* a) {
-    LASSERT_NUM("cmp-bnum", a, 2);
-    LASSERT_TYPE("cmp-bnum", a, 0, LVAL_BNUM);
-    LASSERT_TYPE("cmp-bnum", a, 1, LVAL_BNUM);
-    int v;
+lval* builtin_intlen(lenv* e, lval* a) {
+    LASSERT_NUM("integer-length", a, 1);
+    LASSERT_TYPE2("integer-length", a, 0, LVAL_INUM, LVAL_BNUM);
+    int n;
 
-    v = compare_bignum(&a->cell[0]->bnum, &a->cell[1]->bnum);
-    return lval_inum(v);
+    if (a->cell[0]->type == LVAL_INUM) {
+        intptr_t x = a->cell[0]->inum;
+        uint64_t u = (uint64_t)(x < 0 ? ~x : x);
+        if (u >> 32)
+            n = 64 - clz32((uint32_t)(u >> 32));
+        else
+            n = u ? 32 - clz32((uint32_t)u) : 0;
+    }
+    else {
+        n = length_bignum(&a->cell[0]->bnum);
+    }
+    lval_del(a);
+    return lval_inum(n);
+}
+
+/* (number->string x [radix]) */
+lval* builtin_num_to_str(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function 'number->string' passed incorrect number of arguments. "
+        "Got %i, Expected 1 or 2.", a->count);
+    int radix = 10;
+    char s[BNCHARS];
+    bignum b;
+
+    if (a->count == 2) {
+        LASSERT_TYPE("number->string", a, 1, LVAL_INUM);
+        LASSERT(a, a->cell[1]->inum >= 2 && a->cell[1]->inum <= 36,
+            "Function 'number->string' radix must be between 2 and 36.");
+        radix = (int)a->cell[1]->inum;
+    }
+
+    if (a->cell[0]->type == LVAL_DNUM) {
+        LASSERT(a, radix == 10,
+            "Function 'number->string' prints Floating-Point Numbers in radix 10 only.");
+        snprintf(s, sizeof(s), "%lf", a->cell[0]->dnum);
+    }
+    else {
+        LASSERT_TYPE2("number->string", a, 0, LVAL_INUM, LVAL_BNUM);
+        lval_to_bignum(a->cell[0], &b);
+        bignum_to_string(&b, radix, s);
+    }
+
+    lval_del(a);
+    return lval_str(s);
+}
+
+/* (string->number s [radix]) - Integer if it fits, otherwise BIGNUM */
+lval* builtin_str_to_num(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function 'string->number' passed incorrect number of arguments. "
+        "Got %i, Expected 1 or 2.", a->count);
+    LASSERT_TYPE("string->number", a, 0, LVAL_STR);
+    int radix = 10;
+    bignum b;
+    intptr_t r;
+    char* str = a->cell[0]->str;
+
+    if (a->count == 2) {
+        LASSERT_TYPE("string->number", a, 1, LVAL_INUM);
+        LASSERT(a, a->cell[1]->inum >= 2 && a->cell[1]->inum <= 36,
+            "Function 'string->number' radix must be between 2 and 36.");
+        radix = (int)a->cell[1]->inum;
+    }
+
+    if (radix == 10 && strchr(str, '.')) {
+        char* end;
+        double d = strtod(str, &end);
+        LASSERT(a, *str && *end == '\0',
+            "Function 'string->number' passed invalid number \"%s\".", str);
+        lval_del(a);
+        return lval_dnum(d);
+    }
+
+    LASSERT(a, string_to_bignum(str, radix, &b) == 0,
+        "Function 'string->number' passed invalid number \"%s\" for radix %i.",
+        str, radix);
+    lval_del(a);
+    if (bignum_to_int(&b, &r) == 0) {
+        return lval_inum(r);
+    }
+    return lval_bnum(b);
 }
 
 lval* builtin_ord(lenv* e, lval* a, char* op) {
@@ -1175,14 +1964,18 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
         "Function '%s' passed too many arguments for symbols. "
         "Got %i, Expected %i.", func, syms->count, a->count - 1);
 
+    if (strcmp(func, "def") == 0 || LENV_GLOBAL(e)) { LASSERT_SERIAL(func, a); }
+
     for (int i = 0; i < syms->count; i++) {
         /* If 'def' define in globally. If 'put' define in locally */
         if (strcmp(func, "def") == 0) {
             lenv_def(e, syms->cell[i], a->cell[i + 1]);
         }
 
+        /* At top level the symbol's package decides where it goes */
         if (strcmp(func, "=") == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i + 1]);
+            if (LENV_GLOBAL(e)) { lenv_def(e, syms->cell[i], a->cell[i + 1]); }
+            else { lenv_put(e, syms->cell[i], a->cell[i + 1]); }
         }
     }
 
@@ -1199,44 +1992,36 @@ lval* builtin_put(lenv* e, lval* a) {
     return builtin_var(e, a, "=");
 }
 
+void lenv_print_binding(const char* sym, lval* v) {
+    switch (v->type) {
+    case LVAL_INUM:
+        printf("(%s %lli)\n", sym, v->inum);
+        break;
+    case LVAL_DNUM:
+        printf("(%s %lf)\n", sym, v->dnum);
+        break;
+    case LVAL_SYM:
+        printf("(%s %s)\n", sym, v->sym);
+        break;
+    case LVAL_FUN:
+        printf("(%s {func})\n", sym);
+        break;
+    }
+}
+
 lval* builtin_penv(lenv* e, lval* a) {
-#ifdef HT
-    hti it = ht_iterator(e->h1);
-    while (ht_next(&it)) {
-        switch (((lval*)it.value)->type) {
-        case LVAL_INUM:
-            printf("(%s %lli)\n", it.key, ((lval*)it.value)->inum);
-            break;
-        case LVAL_DNUM:
-            printf("(%s %lf)\n", it.key, ((lval*)it.value)->dnum);
-            break;
-        case LVAL_SYM:
-            printf("(%s %s)\n", it.key, ((lval*)it.value)->sym);
-            break;
-        case LVAL_FUN:
-            printf("(%s {func})\n", it.key);
-            break;
+    LASSERT_NUM("printenv", a, 1);
+    if (e->h1) {
+        hti it = ht_iterator(e->h1);
+        while (ht_next(&it)) {
+            lenv_print_binding(it.key, it.value);
         }
     }
-#else
-    LASSERT_NUM("printenv", a, 1);
-    for (int i = 0; i < e->count; i++) {
-        switch (e->vals[i]->type) {
-        case LVAL_INUM:
-            printf("(%s %lli)\n", e->syms[i], e->vals[i]->inum);
-            break;
-        case LVAL_DNUM:
-            printf("(%s %lf)\n", e->syms[i], e->vals[i]->dnum);
-            break;
-        case LVAL_SYM:
-            printf("(%s %s)\n", e->syms[i], e->vals[i]->sym);
-            break;
-        case LVAL_FUN:
-            printf("(%s {func})\n", e->syms[i]);
-            break;
-        } 
+    else {
+        for (int i = 0; i < e->count; i++) {
+            lenv_print_binding(e->syms[i], e->vals[i]);
+        }
     }
-#endif
     lval_del(a);
     return lval_sexpr();
 }
@@ -1331,14 +2116,15 @@ lval* builtin_gsym(lenv* e, lval* a) {
         s[0] = 'g';
     }
     g = malloc(4 * sizeof(char));
-    l = sprintf(g, "%d", gensym);
+    lispy_ctx* c = lctx->parent ? lctx->parent : lctx;
+    long n = LSHARED(lctx) ? th_atomic_add(&c->gensym, 1) - 1 : c->gensym++;
+    l = sprintf(g, "%ld", n);
     for (int i=0;i<l;i++) s[i+1] = g[i];
     s[l+1] = '\0';
     lval* x = lval_qexpr();
     x->count = 1;
     x->cell = malloc(sizeof(lval));
     x->cell[0]=lval_sym(s);
-    gensym++;
 
     lval_del(a);
     return x;
@@ -1366,12 +2152,73 @@ lval* builtin_range(lenv* e, lval* a) {
 lval* builtin_random(lenv* e, lval* a) {
     LASSERT_TYPE("random", a, 0, LVAL_INUM);
     LASSERT_NUM("random", a, 1);
-    srand((unsigned)time(NULL));
-    lval* x = lval_inum((intptr_t)rand() % a->cell[0]->inum);
+    LASSERT(a, a->cell[0]->inum > 0,
+        "Function 'random' passed non-positive bound.");
+    lval* x = lval_inum((intptr_t)rng_below(&lctx->rng, (uint64_t)a->cell[0]->inum));
     lval_del(a);
     return x;
 }
 
+lval* builtin_seed_random(lenv* e, lval* a) {
+    LASSERT_NUM("seed-random", a, 1);
+    LASSERT_TYPE("seed-random", a, 0, LVAL_INUM);
+    rng_seed(&lctx->rng, (uint64_t)a->cell[0]->inum);
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* (random-bnum n) - uniform BIGNUM of n bits */
+lval* builtin_random_bnum(lenv* e, lval* a) {
+    LASSERT_NUM("random-bnum", a, 1);
+    LASSERT_TYPE("random-bnum", a, 0, LVAL_INUM);
+    LASSERT(a, a->cell[0]->inum >= 0 && a->cell[0]->inum < MAXDIGITS * 4,
+        "Function 'random-bnum' bit count out of range.");
+    bignum b;
+
+    if (random_bignum(&lctx->rng, (int)a->cell[0]->inum, &b) != 0) {
+        lval_del(a);
+        return lval_err("BIGNUM overflow.");
+    }
+    lval_del(a);
+    return lval_bnum(b);
+}
+
+lval* builtin_prime(lenv* e, lval* a) {
+    LASSERT_NUM("prime?", a, 1);
+    LASSERT_TYPE2("prime?", a, 0, LVAL_INUM, LVAL_BNUM);
+    bignum b;
+    int p;
+
+    lval_to_bignum(a->cell[0], &b);
+    p = prime_bignum(&b);
+    lval_del(a);
+    if (p < 0) {
+        return lval_err("Function 'prime?' passed more than %i digits.",
+            MAXDIGITS / 2 - 2);
+    }
+    return lval_inum(p);
+}
+
+/* next prime after x, an Integer stays an Integer when it fits */
+lval* builtin_next_prime(lenv* e, lval* a) {
+    LASSERT_NUM("next-prime", a, 1);
+    LASSERT_TYPE2("next-prime", a, 0, LVAL_INUM, LVAL_BNUM);
+    bignum b, c;
+    intptr_t r;
+    int is_inum = (a->cell[0]->type == LVAL_INUM);
+
+    lval_to_bignum(a->cell[0], &b);
+    lval_del(a);
+    if (next_prime_bignum(&b, &c) != 0) {
+        return lval_err("Function 'next-prime' passed more than %i digits.",
+            MAXDIGITS / 2 - 2);
+    }
+    if (is_inum && bignum_to_int(&c, &r) == 0) {
+        return lval_inum(r);
+    }
+    return lval_bnum(c);
+}
+
 lval* builtin_exit(lenv* e, lval* a) {
     /* More than one number as argument is possible, 
        but it will be ignored */
@@ -1392,49 +2239,70 @@ lval* builtin_exit(lenv* e, lval* a) {
     }
 }
 
-lval* lval_read(mpc_ast_t* t);
-
 lval* builtin_load(lenv* e, lval* a) {
     LASSERT_NUM("load", a, 1);
     LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-    /* Parse File given by string name */
-    mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
-
-        /* Read contents */
-        lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+    /* Each expression is read, evaluated and freed before the next is
+       read. An in-package decides the package of the symbols read
+       after it */
+    pack* saved = lctx->currpack;
+    lval* x;
 
-        /* Evaluate each Expression */
-        while (expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
-            /* If Evaluation leads to error print it */
+    /* Forms cached from this very source skip the reader. One naming a
+       package that does not exist sends the rest of the file through
+       the reader, which reports where */
+    int skip = 0;
+    lcache* c = lcache_open(a->cell[0]->str);
+    if (c) {
+        while ((x = lcache_next(c))) {
+            x = lval_eval(e, x);
             if (x->type == LVAL_ERR) { lval_println(x); }
             lval_del(x);
+            skip++;
+        }
+        int complete = lcache_complete(c);
+        lcache_close(c);
+        if (complete) {
+            lctx->currpack = saved;
+            lval_del(a);
+            return lval_sexpr();
         }
-
-        /* Delete expressions and arguments */
-        lval_del(expr);
-        lval_del(a);
-
-        /* Return empty list */
-        return lval_sexpr();
-
     }
-    else {
-        /* Get Parse Error as String */
-        char* err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
 
-        /* Create new error message using it */
-        lval* err = lval_err("Could not load Library %s", err_msg);
-        free(err_msg);
+    lreader r;
+    if (lreader_open(&r, a->cell[0]->str) != 0) {
+        lval* err = lval_err("Could not load Library %s: %s",
+            a->cell[0]->str, strerror(errno));
         lval_del(a);
-
-        /* Cleanup and return error */
         return err;
     }
+
+    c = skip ? NULL : lcache_create(a->cell[0]->str);
+    while ((x = lreader_next(&r))) {
+        /* A syntax error ends the file */
+        if (r.failed) { break; }
+        /* Forms already evaluated from the cache */
+        if (skip) {
+            skip--;
+            lval_del(x);
+            x = NULL;
+            continue;
+        }
+        if (c) { lcache_add(c, x); }
+        x = lval_eval(e, x);
+        /* If Evaluation leads to error print it */
+        if (x->type == LVAL_ERR) { lval_println(x); }
+        lval_del(x);
+        x = NULL;
+    }
+    if (c) { lcache_finish(c, !r.failed); }
+    lctx->currpack = saved;
+    lreader_close(&r);
+    lval_del(a);
+
+    /* Return the syntax error if any, else empty list */
+    return x ? x : lval_sexpr();
 }
 
 lval* builtin_print(lenv* e, lval* a) {
@@ -1489,28 +2357,47 @@ lval* builtin_readline(lenv* e, lval* a) {
 lval* builtin_makepack(lenv* e, lval* a) {
     LASSERT_NUM("make-package", a, 1);
     LASSERT_TYPE("make-package", a, 0, LVAL_STR);
-    pack* x = pack_new(a->cell[0]->str);
+    LASSERT_SERIAL("make-package", a);
+    LASSERT(a, !pack_find(a->cell[0]->str),
+        "Package %s already exists.", a->cell[0]->str);
 
-    rootpack->plist[rootpack->pcount] = pack_copy(x);
-    rootpack->pcount++;
-    //lval_del(a);
+    pack_new(a->cell[0]->str);
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* make the package current: symbols read from now on belong to it */
+lval* builtin_inpack(lenv* e, lval* a) {
+    LASSERT_NUM("in-package", a, 1);
+    LASSERT_TYPE("in-package", a, 0, LVAL_STR);
+
+    pack* p = pack_find(a->cell[0]->str);
+    LASSERT(a, p, "Package %s not found.", a->cell[0]->str);
+
+    lctx->currpack = p;
+
+    lval_del(a);
     return lval_sexpr();
 }
 
+/* import everything the package binds now into the current one */
+/* each name is resolved to its package here, not at each lookup */
 lval* builtin_usepack(lenv* e, lval* a) {
-    int i = 0;
     LASSERT_NUM("use-package", a, 1);
     LASSERT_TYPE("use-package", a, 0, LVAL_STR);
+    LASSERT_SERIAL("use-package", a);
 
-    while  (i < rootpack->pcount) {
-        if (rootpack->plist[i]->name == a->cell[0]->str) break;
-        i++;
-    }
-
-    if ((i == rootpack->pcount) || (rootpack->pcount == -1)) 
-        return lval_err("Package %s not found.", a->cell[0]->str);
+    pack* p = pack_find(a->cell[0]->str);
+    LASSERT(a, p, "Package %s not found.", a->cell[0]->str);
 
-    currpack = rootpack->plist[i];
+    if (p != lctx->currpack) {
+        if (!lctx->currpack->imports) { lctx->currpack->imports = ht_create(); }
+        hti it = ht_iterator(p->env->h1);
+        while (ht_next(&it)) {
+            ht_set(lctx->currpack->imports, it.key, p);
+        }
+        lctx->ic_version++;
+    }
 
     lval_del(a);
     return lval_sexpr();
@@ -1518,120 +2405,769 @@ lval* builtin_usepack(lenv* e, lval* a) {
 
 lval* builtin_listpack(lenv* e, lval* a) {
     lval* x = lval_qexpr();
-    lval* t = lval_str(":LSPY");
-    lval_add(x, lval_copy(t));
+    lval_add(x, lval_str(lctx->rootpack->name));
 
-    if (rootpack->pcount > -1) {
-        for (int i = 0; i < rootpack->pcount; i++) {
-            t = lval_str(rootpack->plist[i]->name);
-            lval_add(x, t);
-        }
+    for (pack* p = lctx->rootpack->children; p; p = p->next) {
+        lval_add(x, lval_str(p->name));
     }
 
     lval_del(a); 
-    //lval_del(t);
     return x;
 }
 
-/* End of BUILTINS */
+/* Bytes held by an env, its bindings and their top-level values */
+size_t lenv_bytes(lenv* e) {
+    size_t n = sizeof(lenv);
+    if (e->h1) {
+        hti it = ht_iterator(e->h1);
+        while (ht_next(&it)) {
+            n += strlen(it.key) + 1 + sizeof(lval) + 2 * sizeof(void*);
+        }
+    }
+    else {
+        for (int i = 0; i < e->count; i++) {
+            n += strlen(e->syms[i]) + 1 + sizeof(lval);
+        }
+    }
+    return n;
+}
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+/* (package-stats "name") - {live peak created bindings bytes} */
+lval* builtin_packstats(lenv* e, lval* a) {
+    LASSERT_NUM("package-stats", a, 1);
+    LASSERT_TYPE("package-stats", a, 0, LVAL_STR);
 
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
+    pack* p = pack_find(a->cell[0]->str);
+    LASSERT(a, p, "Package %s not found.", a->cell[0]->str);
 
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    intptr_t bindings = 0;
+    intptr_t bytes = 0;
+    for (lenv* x = p->envs; x; x = x->pnext) {
+        bindings += x->count;
+        bytes += (intptr_t)lenv_bytes(x);
     }
 
-    if (v->count == 0) { return v; } /* No func with 0 args allowed */
-    if (v->count == 1) { return lval_take(v, 0); }
+    lval* x = lval_qexpr();
+    lval_add(x, lval_inum(p->ecount));
+    lval_add(x, lval_inum(p->epeak));
+    lval_add(x, lval_inum(p->etotal));
+    lval_add(x, lval_inum(bindings));
+    lval_add(x, lval_inum(bytes));
+    lval_del(a);
+    return x;
+}
 
-    /* Ensure first element is a function after evaluation */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval* err = lval_err(
-            "S-Expression starts with incorrect type. "
-            "Got %s, Expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
-        lval_del(f); lval_del(v);
-        return err;
-    }
+/* (memoize f [capacity]) - f with a result cache keyed on its arguments */
+lval* builtin_memoize(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function 'memoize' passed incorrect number of arguments. "
+        "Got %i, Expected 1 or 2.", a->count);
+    LASSERT_TYPE("memoize", a, 0, LVAL_FUN);
+    int capacity = MEMOCAP;
 
-    lval* result = lval_call(e, f, v);
+    if (a->count == 2) {
+        LASSERT_TYPE("memoize", a, 1, LVAL_INUM);
+        LASSERT(a, a->cell[1]->inum >= 0 && a->cell[1]->inum <= INT_MAX,
+            "Function 'memoize' passed invalid capacity.");
+        capacity = (int)a->cell[1]->inum;
+    }
 
-    lval_del(f);
-    return result;
+    lval* v = lval_builtin(NULL);
+    v->memo = memo_new(lval_pop(a, 0), capacity);
+    lval_del(a);
+    return v;
 }
 
-lval* lval_eval(lenv* e, lval* v) {
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
+/* (memo-stats f) - {hits misses entries capacity} */
+lval* builtin_memo_stats(lenv* e, lval* a) {
+    LASSERT_NUM("memo-stats", a, 1);
+    LASSERT_TYPE("memo-stats", a, 0, LVAL_FUN);
+    LASSERT(a, a->cell[0]->memo != NULL,
+        "Function 'memo-stats' passed a function that is not memoized.");
+
+    memo* m = a->cell[0]->memo;
+    lval* x = lval_qexpr();
+    lval_add(x, lval_inum(m->hits));
+    lval_add(x, lval_inum(m->misses));
+    lval_add(x, lval_inum(m->count));
+    lval_add(x, lval_inum(m->capacity));
+    lval_del(a);
+    return x;
+}
+
+/* (make-map k v ...) */
+lval* builtin_make_map(lenv* e, lval* a) {
+    LASSERT(a, a->count % 2 == 0,
+        "Function 'make-map' passed a key without a value.");
+    lval* m = lval_map();
+    while (a->count) {
+        lval* k = lval_pop(a, 0);
+        lmap_put(m->map, k, lval_pop(a, 0));
+    }
+    lval_del(a);
+    return m;
+}
+
+/* (map-get m k [default]) */
+lval* builtin_map_get(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function 'map-get' passed incorrect number of arguments. "
+        "Got %i, Expected 2 or 3.", a->count);
+    LASSERT_TYPE("map-get", a, 0, LVAL_MAP);
+
+    lval* v = hto_get(a->cell[0]->map->table, lval_hash(a->cell[1]), a->cell[1]);
+    if (v) {
+        v = lval_copy(v);
+    }
+    else if (a->count == 3) {
+        v = lval_pop(a, 2);
+    }
+    else {
+        v = lval_err("No Element Found");
+    }
+    lval_del(a);
+    return v;
+}
+
+/* (map-put m k v) - binds k in m, returns m */
+lval* builtin_map_put(lenv* e, lval* a) {
+    LASSERT_NUM("map-put", a, 3);
+    LASSERT_TYPE("map-put", a, 0, LVAL_MAP);
+    LASSERT(a, !lval_holds(a->cell[1], a->cell[0]->map) &&
+        !lval_holds(a->cell[2], a->cell[0]->map),
+        "Function 'map-put' cannot store a map inside itself.");
+
+    lval* m = lval_pop(a, 0);
+    lval* k = lval_pop(a, 0);
+    lmap_put(m->map, k, lval_pop(a, 0));
+    lval_del(a);
+    return m;
+}
+
+/* (map-del m k) - removes k from m, returns m */
+lval* builtin_map_del(lenv* e, lval* a) {
+    LASSERT_NUM("map-del", a, 2);
+    LASSERT_TYPE("map-del", a, 0, LVAL_MAP);
+
+    void* k;
+    lval* m = lval_pop(a, 0);
+    lval* v = hto_remove(m->map->table, lval_hash(a->cell[0]), a->cell[0], &k);
+    if (v) {
+        lval_del(k);
         lval_del(v);
-        return x;
     }
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    lval_del(a);
+    return m;
+}
+
+lval* builtin_map_has(lenv* e, lval* a) {
+    LASSERT_NUM("map-has?", a, 2);
+    LASSERT_TYPE("map-has?", a, 0, LVAL_MAP);
+
+    int r = hto_get(a->cell[0]->map->table, lval_hash(a->cell[1]), a->cell[1]) != NULL;
+    lval_del(a);
+    return lval_inum(r);
+}
+
+lval* builtin_map_len(lenv* e, lval* a) {
+    LASSERT_NUM("map-len", a, 1);
+    LASSERT_TYPE("map-len", a, 0, LVAL_MAP);
+
+    lval* x = lval_inum((intptr_t)hto_length(a->cell[0]->map->table));
+    lval_del(a);
+    return x;
+}
+
+/* Q-expression of keys, values or {key value} pairs */
+lval* builtin_map_list(lenv* e, lval* a, char* func) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT_TYPE(func, a, 0, LVAL_MAP);
+
+    lval* x = lval_qexpr();
+    htoi it = hto_iterator(a->cell[0]->map->table);
+    while (hto_next(&it)) {
+        if (strcmp(func, "map-keys") == 0) {
+            lval_add(x, lval_copy((lval*)it.key));
+        }
+        if (strcmp(func, "map-vals") == 0) {
+            lval_add(x, lval_copy(it.value));
+        }
+        if (strcmp(func, "map-pairs") == 0) {
+            lval* p = lval_qexpr();
+            lval_add(p, lval_copy((lval*)it.key));
+            lval_add(p, lval_copy(it.value));
+            lval_add(x, p);
+        }
+    }
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_map_keys(lenv* e, lval* a) {
+    return builtin_map_list(e, a, "map-keys");
+}
+
+lval* builtin_map_vals(lenv* e, lval* a) {
+    return builtin_map_list(e, a, "map-vals");
+}
+
+lval* builtin_map_pairs(lenv* e, lval* a) {
+    return builtin_map_list(e, a, "map-pairs");
+}
+
+/* (map-each f m) - calls (f k v) for every entry */
+lval* builtin_map_each(lenv* e, lval* a) {
+    LASSERT_NUM("map-each", a, 2);
+    LASSERT_TYPE("map-each", a, 0, LVAL_FUN);
+    LASSERT_TYPE("map-each", a, 1, LVAL_MAP);
+
+    /* Snapshot the entries so f may change the map */
+    lval* f = lval_pop(a, 0);
+    lval* pairs = builtin_map_pairs(e, a);
+
+    for (int i = 0; i < pairs->count; i++) {
+        lval* args = pairs->cell[i];
+        args->type = LVAL_SEXPR;
+        pairs->cell[i] = lval_sexpr();
+        lval* r = lval_call(e, f, args);
+        if (r->type == LVAL_ERR) {
+            lval_del(f); lval_del(pairs);
+            return r;
+        }
+        lval_del(r);
+    }
+
+    lval_del(f);
+    lval_del(pairs);
+    return lval_sexpr();
+}
+
+static int lenv_holds(lenv* e, void* c) {
+    if (e->h1) {
+        hti it = ht_iterator(e->h1);
+        while (ht_next(&it)) {
+            if (lval_holds(it.value, c)) { return 1; }
+        }
+    }
+    else {
+        for (int i = 0; i < e->count; i++) {
+            if (lval_holds(e->vals[i], c)) { return 1; }
+        }
+    }
+    return e->closure && lenv_holds(e->closure, c);
+}
+
+/* Whether the map or vector c can be reached from x. Storing x in c
+   would then make a cycle, which printing, hashing and comparing never
+   leave and reference counts never free. A function reaches what its
+   partial application bound, not the results a memo has cached, which
+   are let go as the cache evicts them */
+int lval_holds(lval* x, void* c) {
+    switch (x->type) {
+    case LVAL_FUN:
+        if (x->memo) { return lval_holds(x->memo->fn, c); }
+        return !x->builtin && lenv_holds(x->env, c);
+    case LVAL_MAP: {
+        if (x->map == c) { return 1; }
+        htoi it = hto_iterator(x->map->table);
+        while (hto_next(&it)) {
+            if (lval_holds((lval*)it.key, c) || lval_holds(it.value, c)) { return 1; }
+        }
+        return 0;
+    }
+    case LVAL_VEC:
+        if (x->vec == c) { return 1; }
+        for (int i = 0; i < x->vec->count; i++) {
+            if (lval_holds(x->vec->items[i], c)) { return 1; }
+        }
+        return 0;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        for (int i = 0; i < x->count; i++) {
+            if (lval_holds(x->cell[i], c)) { return 1; }
+        }
+        return 0;
+    }
+    return 0;
+}
+
+/* (copy x) - x with every map and vector in it copied. Map and vector
+   literals are read as a call to this, see read_list */
+lval* builtin_copy(lenv* e, lval* a) {
+    LASSERT_NUM("copy", a, 1);
+
+    lval* x = lval_copy_deep(a->cell[0]);
+    lval_del(a);
+    return x;
+}
+
+/* (make-vec n fill) */
+lval* builtin_make_vec(lenv* e, lval* a) {
+    LASSERT_NUM("make-vec", a, 2);
+    LASSERT_TYPE("make-vec", a, 0, LVAL_INUM);
+    LASSERT(a, a->cell[0]->inum >= 0 && a->cell[0]->inum <= INT_MAX,
+        "Function 'make-vec' passed invalid size %lli.", a->cell[0]->inum);
+
+    int n = (int)a->cell[0]->inum;
+    lval* v = lval_vec(n);
+    for (int i = 0; i < n; i++) {
+        v->vec->items[i] = lval_copy(a->cell[1]);
+    }
+    v->vec->count = n;
+    lval_del(a);
     return v;
 }
 
-lval* lval_read_inum(mpc_ast_t* t) {
-    errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ?
-        lval_inum(x) : lval_err("invalid number");
+/* Checks argument 1 is a valid index into the vector in argument 0 */
+#define LASSERT_INDEX(func, args) \
+  LASSERT(args, args->cell[1]->inum >= 0 && \
+    args->cell[1]->inum < args->cell[0]->vec->count, \
+    "Function '%s' passed index %lli out of range for length %i.", \
+    func, args->cell[1]->inum, args->cell[0]->vec->count)
+
+/* (vec-ref v i) */
+lval* builtin_vec_ref(lenv* e, lval* a) {
+    LASSERT_NUM("vec-ref", a, 2);
+    LASSERT_TYPE("vec-ref", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-ref", a, 1, LVAL_INUM);
+    LASSERT_INDEX("vec-ref", a);
+
+    lval* x = lval_copy(a->cell[0]->vec->items[a->cell[1]->inum]);
+    lval_del(a);
+    return x;
 }
 
-lval* lval_read_dnum(mpc_ast_t* t) {
-    errno = 0;
-    double x = strtod(t->contents, NULL);
-    return errno != ERANGE ?
-        lval_dnum(x) : lval_err("invalid number");
+/* (vec-set! v i x) - replaces item i, returns v */
+lval* builtin_vec_set(lenv* e, lval* a) {
+    LASSERT_NUM("vec-set!", a, 3);
+    LASSERT_TYPE("vec-set!", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-set!", a, 1, LVAL_INUM);
+    LASSERT_INDEX("vec-set!", a);
+    LASSERT(a, !lval_holds(a->cell[2], a->cell[0]->vec),
+        "Function 'vec-set!' cannot store a vector inside itself.");
+
+    lval* v = lval_pop(a, 0);
+    intptr_t i = a->cell[0]->inum;
+    lval_del(v->vec->items[i]);
+    v->vec->items[i] = lval_pop(a, 1);
+    lval_del(a);
+    return v;
 }
 
-lval* lval_read_str(mpc_ast_t* t) {
-    /* Cut off the final quote character */
-    t->contents[strlen(t->contents) - 1] = '\0';
-    /* Copy the string missing out the first quote character */
-    char* unescaped = malloc(strlen(t->contents + 1) + 1);
-    strcpy(unescaped, t->contents + 1);
-    /* Pass through the unescape function */
-    unescaped = mpcf_unescape(unescaped);
-    /* Construct a new lval using the string */
-    lval* str = lval_str(unescaped);
-    /* Free the string and return */
-    free(unescaped);
-    return str;
+/* (vec-push v x ...) - appends each x, returns v */
+lval* builtin_vec_push(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 2,
+        "Function 'vec-push' passed incorrect number of arguments. "
+        "Got %i, Expected at least 2.", a->count);
+    LASSERT_TYPE("vec-push", a, 0, LVAL_VEC);
+    for (int i = 1; i < a->count; i++) {
+        LASSERT(a, !lval_holds(a->cell[i], a->cell[0]->vec),
+            "Function 'vec-push' cannot store a vector inside itself.");
+    }
+
+    lval* v = lval_pop(a, 0);
+    for (int i = 0; i < a->count; i++) {
+        lvec_push(v->vec, a->cell[i]);
+    }
+    /* The items now belong to the vector */
+    a->count = 0;
+    lval_del(a);
+    return v;
 }
 
-lval* lval_read(mpc_ast_t* t) {
+lval* builtin_vec_len(lenv* e, lval* a) {
+    LASSERT_NUM("vec-len", a, 1);
+    LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
 
-    /* If Symbol or Number return conversion to that type */
-    if (strstr(t->tag, "numbI")) { return lval_read_inum(t); }
-    if (strstr(t->tag, "numbF")) { return lval_read_dnum(t); }
-    if (strstr(t->tag, "string")) { return lval_read_str(t); }
-    if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
-    
+    lval* x = lval_inum(a->cell[0]->vec->count);
+    lval_del(a);
+    return x;
+}
 
-    /* If root (>) or sexpr then create empty list */
-    lval* x = NULL;
-    if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-    if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
-    if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
+/* (list->vec {..}) - hands the list's cells to the vector */
+lval* builtin_list_to_vec(lenv* e, lval* a) {
+    LASSERT_NUM("list->vec", a, 1);
+    LASSERT_TYPE("list->vec", a, 0, LVAL_QEXPR);
 
-    /* Fill this list with any valid expression contained within */
-    for (int i = 0; i < t->children_num; i++) {
-        if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
-        if (strstr(t->children[i]->tag, "comment")) { continue; }
-        x = lval_add(x, lval_read(t->children[i]));
+    lval* q = lval_pop(a, 0);
+    lval* v = lval_vec(0);
+    if (q->count) {
+        free(v->vec->items);
+        v->vec->items = q->cell;
+        v->vec->count = v->vec->capacity = q->count;
+        q->cell = NULL;
+        q->count = 0;
     }
+    lval_del(q);
+    lval_del(a);
+    return v;
+}
+
+/* (vec->list v) */
+lval* builtin_vec_to_list(lenv* e, lval* a) {
+    LASSERT_NUM("vec->list", a, 1);
+    LASSERT_TYPE("vec->list", a, 0, LVAL_VEC);
+
+    lvec* v = a->cell[0]->vec;
+    lval* q = lval_qexpr();
+    q->count = v->count;
+    q->cell = malloc(sizeof(lval*) * v->count);
+    for (int i = 0; i < v->count; i++) {
+        q->cell[i] = lval_copy(v->items[i]);
+    }
+    lval_del(a);
+    return q;
+}
+
+/* Native list functions, replacing the recursive prelude versions */
 
+/* Value of list item i as the prelude's fst would produce it */
+lval* lval_item(lenv* e, lval* l, int i) {
+    return lval_eval(e, lval_copy(l->cell[i]));
+}
+
+/* True for a number other than zero */
+int lval_truthy(lval* x) {
+    return x->type == LVAL_DNUM ? x->dnum != 0.0 : x->inum != 0;
+}
+
+lval* builtin_len(lenv* e, lval* a) {
+    LASSERT_NUM("len", a, 1);
+    LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
+
+    lval* x = lval_inum(a->cell[0]->count);
+    lval_del(a);
     return x;
 }
+
+lval* builtin_nth(lenv* e, lval* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_INUM);
+    LASSERT_TYPE("nth", a, 1, LVAL_QEXPR);
+    /* Out of range, the prelude's nth ran off the list in tail, or in
+       head when it stopped just past the end */
+    intptr_t n = a->cell[0]->inum;
+    LASSERT(a, n >= 0 && n <= a->cell[1]->count,
+        "Function 'tail' passed {} for argument 0.");
+    LASSERT(a, n < a->cell[1]->count,
+        "Function 'head' passed {} for argument 0.");
+
+    lval* x = lval_item(e, a->cell[1], (int)a->cell[0]->inum);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_last(lenv* e, lval* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_TYPE("last", a, 0, LVAL_QEXPR);
+    /* The prelude's last was an nth that ran off the list in tail */
+    LASSERT_NOT_EMPTY("tail", a, 0);
+
+    lval* x = lval_item(e, a->cell[0], a->cell[0]->count - 1);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+    LASSERT_NUM("map", a, 2);
+    LASSERT_TYPE("map", a, 0, LVAL_FUN);
+    LASSERT_TYPE("map", a, 1, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * l->count);
+
+    for (int i = 0; i < l->count; i++) {
+        lval* item = lval_item(e, l, i);
+        lval* r = item->type == LVAL_ERR ? item : lval_call1(e, f, item);
+        if (r->type == LVAL_ERR) {
+            lval_del(x); lval_del(a);
+            return r;
+        }
+        x->cell[x->count++] = r;
+    }
+
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_filter(lenv* e, lval* a) {
+    LASSERT_NUM("filter", a, 2);
+    LASSERT_TYPE("filter", a, 0, LVAL_FUN);
+    LASSERT_TYPE("filter", a, 1, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * l->count);
+
+    for (int i = 0; i < l->count; i++) {
+        lval* item = lval_item(e, l, i);
+        lval* r = item->type == LVAL_ERR ? item : lval_call1(e, f, item);
+        if (r->type != LVAL_INUM && r->type != LVAL_DNUM) {
+            /* The prelude's filter tested the result with if */
+            lval* err = r->type == LVAL_ERR ? r : lval_err(
+                "Function 'if' passed incorrect type for argument 0. Got %s, "
+                "Expected Integer Number or Floating-Point Number.", ltype_name(r->type));
+            if (err != r) { lval_del(r); }
+            lval_del(x); lval_del(a);
+            return err;
+        }
+        /* Keep the item as written, not as evaluated */
+        if (lval_truthy(r)) { x->cell[x->count++] = lval_copy(l->cell[i]); }
+        lval_del(r);
+    }
+
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_reverse(lenv* e, lval* a) {
+    LASSERT_NUM("reverse", a, 1);
+    LASSERT_TYPE("reverse", a, 0, LVAL_QEXPR);
+
+    lval* x = lval_take(a, 0);
+    for (int i = 0, j = x->count - 1; i < j; i++, j--) {
+        lval* t = x->cell[i];
+        x->cell[i] = x->cell[j];
+        x->cell[j] = t;
+    }
+    return x;
+}
+
+/* (foldl f z l) and (foldr f z l) */
+lval* builtin_fold(lenv* e, lval* a, char* func) {
+    LASSERT_NUM(func, a, 3);
+    LASSERT_TYPE(func, a, 0, LVAL_FUN);
+    LASSERT_TYPE(func, a, 2, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[2];
+    lval* acc = lval_copy(a->cell[1]);
+    int left = strcmp(func, "foldl") == 0;
+
+    for (int k = 0; k < l->count; k++) {
+        lval* item = lval_item(e, l, left ? k : l->count - 1 - k);
+        if (item->type == LVAL_ERR) {
+            lval_del(acc);
+            acc = item;
+            break;
+        }
+        acc = left ? lval_call2(e, f, acc, item) : lval_call2(e, f, item, acc);
+        if (acc->type == LVAL_ERR) { break; }
+    }
+
+    lval_del(a);
+    return acc;
+}
+
+lval* builtin_foldl(lenv* e, lval* a) {
+    return builtin_fold(e, a, "foldl");
+}
+
+lval* builtin_foldr(lenv* e, lval* a) {
+    return builtin_fold(e, a, "foldr");
+}
+
+/* (take n l) and (drop n l) */
+lval* builtin_split_at(lenv* e, lval* a, char* func) {
+    LASSERT_NUM(func, a, 2);
+    LASSERT_TYPE(func, a, 0, LVAL_INUM);
+    LASSERT_TYPE(func, a, 1, LVAL_QEXPR);
+    /* Out of range, the prelude's take ran off the list in head and
+       its drop in tail */
+    LASSERT(a, a->cell[0]->inum >= 0 && a->cell[0]->inum <= a->cell[1]->count,
+        "Function '%s' passed {} for argument 0.",
+        strcmp(func, "take") == 0 ? "head" : "tail");
+
+    int n = (int)a->cell[0]->inum;
+    lval* x = lval_take(a, 1);
+    int from = strcmp(func, "take") == 0 ? n : 0;
+    int to = strcmp(func, "take") == 0 ? x->count : n;
+
+    for (int i = from; i < to; i++) { lval_del(x->cell[i]); }
+    memmove(&x->cell[from], &x->cell[to], sizeof(lval*) * (x->count - to));
+    x->count -= to - from;
+    return x;
+}
+
+lval* builtin_take(lenv* e, lval* a) {
+    return builtin_split_at(e, a, "take");
+}
+
+lval* builtin_drop(lenv* e, lval* a) {
+    return builtin_split_at(e, a, "drop");
+}
+
+lval* builtin_elem(lenv* e, lval* a) {
+    LASSERT_NUM("elem", a, 2);
+    LASSERT_TYPE("elem", a, 1, LVAL_QEXPR);
+
+    int found = 0;
+    lval* l = a->cell[1];
+    for (int i = 0; i < l->count && !found; i++) {
+        lval* item = lval_item(e, l, i);
+        if (item->type == LVAL_ERR) {
+            lval_del(a);
+            return item;
+        }
+        found = lval_eq(a->cell[0], item);
+        lval_del(item);
+    }
+
+    lval_del(a);
+    return lval_inum(found);
+}
+
+lval* builtin_zip(lenv* e, lval* a) {
+    LASSERT_NUM("zip", a, 2);
+    LASSERT_TYPE("zip", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("zip", a, 1, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    lval* r = a->cell[1];
+    lval* x = lval_qexpr();
+    x->count = l->count < r->count ? l->count : r->count;
+    x->cell = malloc(sizeof(lval*) * x->count);
+
+    for (int i = 0; i < x->count; i++) {
+        lval* p = lval_qexpr();
+        lval_add(p, lval_copy(l->cell[i]));
+        lval_add(p, lval_copy(r->cell[i]));
+        x->cell[i] = p;
+    }
+
+    lval_del(a);
+    return x;
+}
+
+/* (sum l) - one n-ary + over the list */
+lval* builtin_sum(lenv* e, lval* a) {
+    LASSERT_NUM("sum", a, 1);
+    LASSERT_TYPE("sum", a, 0, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    lval* args = lval_sexpr();
+    args->cell = malloc(sizeof(lval*) * (l->count + 1));
+    args->cell[args->count++] = lval_inum(0);
+    for (int i = 0; i < l->count; i++) {
+        lval* item = lval_item(e, l, i);
+        if (item->type == LVAL_ERR) {
+            lval_del(args); lval_del(a);
+            return item;
+        }
+        args->cell[args->count++] = item;
+    }
+
+    lval_del(a);
+    return builtin_add(e, args);
+}
+
+/* End of BUILTINS */
+
+lic* lic_new(void) {
+    lic* c = malloc(sizeof(lic));
+    c->sym = NULL;
+    c->pkg = NULL;
+    c->val = NULL;
+    c->version = 0;
+    c->refs = 1;
+    return c;
+}
+
+void lic_release(lic* c) {
+    if (LREF_DEC(c->refs) > 0) { return; }
+    free(c->sym);
+    free(c);
+}
+
+/* The global function bound to k, through the call site cache c.
+   NULL if k may be bound locally or is not a global function */
+lval* lic_lookup(lic* c, lval* k) {
+    char* sym = k->sym;
+    if (lctx->pending && ht_get(lctx->pending, sym)) { return NULL; }
+    if (c->version == lctx->ic_version && c->pkg == k->pkg && strcmp(c->sym, sym) == 0) {
+        return c->val;
+    }
+    if (!lctx->rootenv || (lctx->shadowed && ht_get(lctx->shadowed, sym))) { return NULL; }
+
+    lval* f = lenv_global(k);
+    if (!f || f->type != LVAL_FUN) { return NULL; }
+
+    /* Tasks share the cache, it is only filled while there are none */
+    if (LSHARED(lctx)) { return f; }
+
+    if (!c->sym || strcmp(c->sym, sym) != 0) {
+        free(c->sym);
+        c->sym = malloc(strlen(sym) + 1);
+        strcpy(c->sym, sym);
+    }
+    c->val = f;
+    c->pkg = k->pkg;
+    c->version = lctx->ic_version;
+    return f;
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+
+    /* Try the call site cache for the function */
+    lval* f = NULL;
+    long version = lctx->ic_version;
+    if (v->ic && v->count > 1 && v->cell[0]->type == LVAL_SYM) {
+        f = lic_lookup(v->ic, v->cell[0]);
+    }
+
+    for (int i = f ? 1 : 0; i < v->count; i++) {
+        v->cell[i] = lval_eval(e, v->cell[i]);
+    }
+
+    /* Evaluating the arguments may have rebound the function */
+    if (f && version != lctx->ic_version) {
+        f = NULL;
+        v->cell[0] = lval_eval(e, v->cell[0]);
+    }
+
+    for (int i = 0; i < v->count; i++) {
+        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    }
+
+    if (f) {
+        /* The cached value stays in its package env, so call it without consuming */
+        lval_del(lval_pop(v, 0));
+        return lval_call(e, f, v);
+    }
+
+    if (v->count == 0) { return v; } /* No func with 0 args allowed */
+    if (v->count == 1) { return lval_take(v, 0); }
+
+    /* Ensure first element is a function after evaluation */
+    f = lval_pop(v, 0);
+    if (f->type != LVAL_FUN) {
+        lval* err = lval_err(
+            "S-Expression starts with incorrect type. "
+            "Got %s, Expected %s.",
+            ltype_name(f->type), ltype_name(LVAL_FUN));
+        lval_del(f); lval_del(v);
+        return err;
+    }
+
+    lval* result = lval_call(e, f, v);
+
+    lval_del(f);
+    return result;
+}
+
+lval* lval_eval(lenv* e, lval* v) {
+    if (v->type == LVAL_SYM) {
+        lval* x = lenv_get(e, v);
+        lval_del(v);
+        return x;
+    }
+    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    return v;
+}
+
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
     lval* k = lval_sym(name);
     lval* v = lval_builtin(func);
@@ -1639,71 +3175,160 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
     lval_del(k); lval_del(v);
 }
 
-void lenv_add_builtins(lenv* e) {
+void lenv_add_flag(lenv* e, char* name, intptr_t value) {
+    lval* k = lval_sym(name);
+    lval* v = lval_inum(value);
+    lenv_put(e, k, v);
+    lval_del(k); lval_del(v);
+}
+
+/* Every builtin, registered in this order. Images refer to builtins by
+   their index here */
+lbuiltin_def lbuiltins[] = {
     /* List Functions */
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "eval", builtin_eval);
-    lenv_add_builtin(e, "join", builtin_join);
-    lenv_add_builtin(e, "cons", builtin_cons);
+    { "list", builtin_list },
+    { "head", builtin_head },
+    { "tail", builtin_tail },
+    { "eval", builtin_eval },
+    { "join", builtin_join },
+    { "cons", builtin_cons },
+    { "len", builtin_len },
+    { "nth", builtin_nth },
+    { "last", builtin_last },
+    { "map", builtin_map },
+    { "filter", builtin_filter },
+    { "reverse", builtin_reverse },
+    { "foldl", builtin_foldl },
+    { "foldr", builtin_foldr },
+    { "take", builtin_take },
+    { "drop", builtin_drop },
+    { "elem", builtin_elem },
+    { "zip", builtin_zip },
+    { "sum", builtin_sum },
+    { "sort", builtin_sort },
+
+    /* Map Functions */
+    { "make-map", builtin_make_map },
+    { "map-get", builtin_map_get },
+    { "map-put", builtin_map_put },
+    { "map-del", builtin_map_del },
+    { "map-has?", builtin_map_has },
+    { "map-len", builtin_map_len },
+    { "map-keys", builtin_map_keys },
+    { "map-vals", builtin_map_vals },
+    { "map-pairs", builtin_map_pairs },
+    { "map-each", builtin_map_each },
+    { "copy", builtin_copy },
+
+    /* Vector Functions */
+    { "make-vec", builtin_make_vec },
+    { "vec-ref", builtin_vec_ref },
+    { "vec-set!", builtin_vec_set },
+    { "vec-push", builtin_vec_push },
+    { "vec-len", builtin_vec_len },
+    { "list->vec", builtin_list_to_vec },
+    { "vec->list", builtin_vec_to_list },
+
+    /* Parallel Functions */
+    { "pmap", builtin_pmap },
+    { "pfor-each", builtin_pforeach },
+    { "preduce", builtin_preduce },
+    { "psort", builtin_psort },
+    { "future", builtin_future },
+    { "touch", builtin_touch },
+
+    /* Channel Functions */
+    { "make-chan", builtin_make_chan },
+    { "chan-send", builtin_chan_send },
+    { "chan-recv", builtin_chan_recv },
+    { "chan-close", builtin_chan_close },
+    { "spawn", builtin_spawn },
 
     /* Debug / Internal Functions */
-    lenv_add_builtin(e, "printenv", builtin_penv);
-    lenv_add_builtin(e, "error", builtin_error);
-    lenv_add_builtin(e, "print", builtin_print);
-    lenv_add_builtin(e, "dpb", builtin_dpb);
-    lenv_add_builtin(e, "ldb", builtin_ldb);
-    lenv_add_builtin(e, "make-package", builtin_makepack);
-    lenv_add_builtin(e, "use-package", builtin_usepack);
-    lenv_add_builtin(e, "list-package", builtin_listpack);
+    { "printenv", builtin_penv },
+    { "error", builtin_error },
+    { "print", builtin_print },
+    { "dpb", builtin_dpb },
+    { "ldb", builtin_ldb },
+    { "make-package", builtin_makepack },
+    { "use-package", builtin_usepack },
+    { "in-package", builtin_inpack },
+    { "list-package", builtin_listpack },
+    { "package-stats", builtin_packstats },
 
     /* Variable Functions */
-    lenv_add_builtin(e, "def", builtin_def);
-    lenv_add_builtin(e, "\\", builtin_lambda);
-    lenv_add_builtin(e, "=", builtin_put);
-    lenv_add_builtin(e, "gensym", builtin_gsym);
-    lenv_add_builtin(e, "range", builtin_range);
+    { "def", builtin_def },
+    { "\\", builtin_lambda },
+    { "=", builtin_put },
+    { "gensym", builtin_gsym },
+    { "range", builtin_range },
+    { "memoize", builtin_memoize },
+    { "memo-stats", builtin_memo_stats },
 
 
     /* Mathematical Functions */
-    lenv_add_builtin(e, "+", builtin_add);
-    lenv_add_builtin(e, "-", builtin_sub);
-    lenv_add_builtin(e, "*", builtin_mul);
-    lenv_add_builtin(e, "/", builtin_div);
-    lenv_add_builtin(e, "^", builtin_pow);
-    lenv_add_builtin(e, "%", builtin_mod);
-    lenv_add_builtin(e, "random", builtin_random);
+    { "+", builtin_add },
+    { "-", builtin_sub },
+    { "*", builtin_mul },
+    { "/", builtin_div },
+    { "^", builtin_pow },
+    { "%", builtin_mod },
+    { "random", builtin_random },
+    { "seed-random", builtin_seed_random },
+    { "random-bnum", builtin_random_bnum },
+    { "prime?", builtin_prime },
+    { "next-prime", builtin_next_prime },
     /* integer bignum */
-    lenv_add_builtin(e, "addb", builtin_addb);
-    lenv_add_builtin(e, "subb", builtin_subb);
-    lenv_add_builtin(e, "mulb", builtin_mulb);
-    lenv_add_builtin(e, "divb", builtin_divb);
+    { "addb", builtin_addb },
+    { "subb", builtin_subb },
+    { "mulb", builtin_mulb },
+    { "divb", builtin_divb },
     /* conversion */
-    lenv_add_builtin(e, "to-bnum", builtin_i_to_bnum);
+    { "to-bnum", builtin_i_to_bnum },
+    { "number->string", builtin_num_to_str },
+    { "string->number", builtin_str_to_num },
+    /* bitwise */
+    { "logand", builtin_logand },
+    { "logior", builtin_logior },
+    { "logxor", builtin_logxor },
+    { "lognot", builtin_lognot },
+    { "ash", builtin_ash },
+    { "popcount", builtin_popcount },
+    { "integer-length", builtin_intlen },
 
     /* Comparison Functions */
-    lenv_add_builtin(e, "if", builtin_if);
-    lenv_add_builtin(e, "==", builtin_eq);
-    lenv_add_builtin(e, "!=", builtin_ne);
-    lenv_add_builtin(e, ">", builtin_gt);
-    lenv_add_builtin(e, "<", builtin_lt);
-    lenv_add_builtin(e, ">=", builtin_ge);
-    lenv_add_builtin(e, "<=", builtin_le);
+    { "if", builtin_if },
+    { "==", builtin_eq },
+    { "!=", builtin_ne },
+    { ">", builtin_gt },
+    { "<", builtin_lt },
+    { ">=", builtin_ge },
+    { "<=", builtin_le },
 
-    lenv_add_builtin(e, "cmp-bnum", builtin_cmp_bnum);
+    { "cmp-bnum", builtin_cmp_bnum },
 
     /* OS level Functions */
-    lenv_add_builtin(e, "exit", builtin_exit);
-    lenv_add_builtin(e, "load", builtin_load);
-    lenv_add_builtin(e, "read-line", builtin_readline);
+    { "exit", builtin_exit },
+    { "load", builtin_load },
+    { "read-line", builtin_readline },
+};
+
+int lbuiltins_count = sizeof(lbuiltins) / sizeof(lbuiltins[0]);
+
+void lenv_add_builtins(lenv* e) {
+    for (int i = 0; i < lbuiltins_count; i++) {
+        lenv_add_builtin(e, lbuiltins[i].name, lbuiltins[i].func);
+    }
+
+    /* When 0 the prelude replaces the native list functions with Lisp ones */
+    lenv_add_flag(e, "native-lists", 1);
 }
 
+#ifndef LISPY_EMBED
 int main(int argc, char** argv) {
     int lisp_version = 0;
     int lisp_build = 0;
     int mv = 0;
-    initialize_bignum(&BZERO);
 
     lisp_version = (int)hypot(LVER * 42.0, 42.0);
     lisp_build = (int)(100000*(hypot(LVER + 42.0, 42.0) - (int)hypot(LVER + 42.0, 42.0)));
@@ -1711,34 +3336,6 @@ int main(int argc, char** argv) {
     mv = mi_version();
 #endif
 
-    Number = mpc_new("number");
-    NumbI = mpc_new("numbI");
-    NumbF = mpc_new("numbF");
-    String = mpc_new("string");
-    Comment = mpc_new("comment");
-    Symbol = mpc_new("symbol");
-    Sexpr = mpc_new("sexpr");
-    Qexpr = mpc_new("qexpr");
-    Expr = mpc_new("expr");
-    Lispy = mpc_new("lispy");
-
-    mpca_lang(MPCA_LANG_DEFAULT,
-        "                                           \
-      numbF  : /-?[0-9]+\\.[0-9]+/ ;                \
-      numbI  : /-?[0-9]+/ ;                         \
-      number : <numbF> | <numbI> ;                  \
-      symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^]+/ ; \
-      string : /\"(\\\\.|[^\"])*\"/ ;               \
-      comment : /;[^\\r\\n]*/ ;                     \
-      sexpr  : '(' <expr>* ')' ;                    \
-      qexpr  : '{' <expr>* '}' ;                    \
-      expr   : <number>  | <symbol> | <string> |    \
-               <comment> | <sexpr>  | <qexpr> ;     \
-      lispy  : /^/ <expr>* /$/ ;                    \
-        ",
-        Number, NumbI, NumbF, Symbol, Comment, String, 
-        Sexpr, Qexpr, Expr, Lispy);
-
     printf("Lispy Version %x (build %x m.%d)\n", lisp_version, lisp_build, 
 #ifndef _DEBUG
         mv
@@ -1747,40 +3344,66 @@ int main(int argc, char** argv) {
 #endif
     );
 
-    rootpack = pack_init(); /* create the root elem for packages */
-    
-    lenv* e = lenv_new();
+    lctx = lctx_new();
+    lenv* e = lctx->rootenv;
     
-    lenv_add_builtins(e);
+    /* An image stands in for the builtins and whatever was loaded
+       before it was saved */
+    int first = 1;
+    if (argc >= 3 && strcmp(argv[1], "--image") == 0) {
+        lval* x = image_load(argv[2]);
+        if (x->type == LVAL_ERR) { lval_println(x); return 1; }
+        lval_del(x);
+        first = 3;
+    }
+    else {
+        lenv_add_builtins(e);
+    }
 
-    if (argc == 1) {
+    if (argc == first) {
         puts("Press Ctrl+c to Exit\n");
         while (1) {
 
             char* input = readline("lispy> ");
+            if (!input) { break; }
             add_history(input);
 
-            mpc_result_t r;
-            if (mpc_parse("<stdin>", input, Lispy, &r)) {
-                lval* x = lval_eval(e, lval_read(r.output));
-                lval_println(x);
-                lval_del(x);
-                mpc_ast_delete(r.output);
-            }
-            else {
-                mpc_err_print(r.error);
-                mpc_err_delete(r.error);
-            }
+            lreader r;
+            lreader_init(&r, "<stdin>", input, strlen(input));
+            lval* x = lreader_all(&r);
+            if (!r.failed) { x = lval_eval(e, x); }
+            lval_println(x);
+            lval_del(x);
 
             free(input);
         }
     }
     
     /* Supplied with list of files */
-    if (argc >= 2) {
+    if (argc > first) {
+
+        /* loop over each supplied filename (after any image) */
+        for (int i = first; i < argc; i++) {
 
-        /* loop over each supplied filename (starting from 1) */
-        for (int i = 1; i < argc; i++) {
+            /* Use the prelude's Lisp list functions, for comparison */
+            if (strcmp(argv[i], "--lisp-lists") == 0) {
+                lenv_add_flag(e, "native-lists", 0);
+                continue;
+            }
+
+            /* Neither use nor write .lspc source caches */
+            if (strcmp(argv[i], "--no-cache") == 0) {
+                lctx->cache = 0;
+                continue;
+            }
+
+            /* Snapshot everything loaded so far */
+            if (strcmp(argv[i], "--save-image") == 0 && i + 1 < argc) {
+                lval* x = image_save(argv[++i]);
+                if (x->type == LVAL_ERR) { lval_println(x); }
+                lval_del(x);
+                continue;
+            }
 
             /* Argument list with a single argument, the filename */
             lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
@@ -1794,10 +3417,8 @@ int main(int argc, char** argv) {
         }
     }
 
-    lenv_del(e);
-
-    mpc_cleanup(10, Number, NumbI, NumbF, Symbol, String, Comment, 
-        Sexpr, Qexpr, Expr, Lispy);
+    lctx_del(lctx);
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,820 @@
+#include "par.h"
+
+volatile long lparallel = 0;
+
+/* Taken by tasks around updates of shared state, see lpar_lock */
+static th_mutex par_mutex;
+static volatile long par_state = 0; /* 0 new, 1 starting, 2 ready */
+
+static void lpar_start(void) {
+    if (th_atomic_load(&par_state) == 2) { return; }
+    if (th_atomic_cas(&par_state, 0, 1)) {
+        th_mutex_init(&par_mutex);
+        th_atomic_add(&par_state, 1);
+    }
+    while (th_atomic_add(&par_state, 0) != 2) { th_yield(); }
+}
+
+/* A host freeing values through lispy_free runs with no context, and
+   nothing else can be touching that context's packages then */
+void lpar_lock(void) {
+    if (lctx && LSHARED(lctx)) { th_mutex_lock(&par_mutex); }
+}
+
+void lpar_unlock(void) {
+    if (lctx && LSHARED(lctx)) { th_mutex_unlock(&par_mutex); }
+}
+
+/* Names bound locally for the first time by a task can no longer be
+   cached at call sites. While c is shared they wait in its own pending
+   table, see lpar_settle */
+static void lpar_merge(lispy_ctx* c, ht* p) {
+    hti it = ht_iterator(p);
+    while (ht_next(&it)) {
+        if (LSHARED(c)) {
+            if (!c->pending) { c->pending = ht_create(); }
+            ht_set(c->pending, it.key, c->pending);
+        }
+        else if (!c->shadowed || !ht_get(c->shadowed, it.key)) {
+            if (!c->shadowed) { c->shadowed = ht_create(); }
+            ht_set(c->shadowed, it.key, c->shadowed);
+            c->ic_version++;
+        }
+    }
+    ht_destroy(p);
+}
+
+/* Once nothing shares c, its pending names become shadowed ones */
+static void lpar_settle(lispy_ctx* c) {
+    if (LSHARED(c) || !c->pending) { return; }
+    ht* p = c->pending;
+    c->pending = NULL;
+    lpar_merge(c, p);
+}
+
+typedef struct {
+    lpar_fn fn;
+    void* arg;
+    lispy_ctx* tasks;  /* one context per index */
+} lpar_job;
+
+static void lpar_task(void* p, int i) {
+    lpar_job* j = p;
+    lispy_ctx* saved = lctx;
+    lctx = &j->tasks[i];
+    j->fn(j->arg, i);
+    lctx = saved;
+}
+
+void lpar_for(lpar_fn fn, void* arg, int n) {
+    lispy_ctx* c = lctx;
+    if (c->parent || n < 2) {
+        for (int i = 0; i < n; i++) { fn(arg, i); }
+        return;
+    }
+    lpar_start();
+
+    lpar_job j;
+    j.fn = fn;
+    j.arg = arg;
+    j.tasks = malloc(sizeof(lispy_ctx) * n);
+    for (int i = 0; i < n; i++) {
+        j.tasks[i] = *c;
+        j.tasks[i].parent = c;
+        j.tasks[i].pending = NULL;
+        j.tasks[i].live = 0;
+        rng_seed(&j.tasks[i].rng, rng_next(&c->rng));
+    }
+
+    th_atomic_add(&lparallel, 1);
+    thpool_for(lpar_task, &j, n);
+    th_atomic_add(&lparallel, -1);
+
+    for (int i = 0; i < n; i++) {
+        if (j.tasks[i].pending) { lpar_merge(c, j.tasks[i].pending); }
+    }
+    free(j.tasks);
+}
+
+/* A few tasks per thread, so uneven items still spread out */
+int lpar_chunks(int n) {
+    int k = 4 * thpool_size();
+    return n < k ? n : k;
+}
+
+/* pmap and pfor-each: each task calls f on a contiguous run of l */
+typedef struct {
+    lenv* e;
+    lval* f;
+    lval* l;
+    lval** out;   /* results in list order, NULL for pfor-each */
+    lval** errs;  /* first error of each task */
+    int chunks;
+} lpar_map;
+
+static void pmap_chunk(void* p, int c) {
+    lpar_map* m = p;
+    int n = m->l->count;
+    int lo = (int)((long long)n * c / m->chunks);
+    int hi = (int)((long long)n * (c + 1) / m->chunks);
+    for (int i = lo; i < hi; i++) {
+        lval* item = lval_item(m->e, m->l, i);
+        lval* r = item->type == LVAL_ERR ? item : lval_call1(m->e, m->f, item);
+        if (r->type == LVAL_ERR) {
+            m->errs[c] = r;
+            for (; i < hi; i++) { if (m->out) { m->out[i] = NULL; } }
+            return;
+        }
+        if (m->out) { m->out[i] = r; } else { lval_del(r); }
+    }
+}
+
+static lval* pmap_run(lenv* e, lval* a, int keep) {
+    lpar_map m;
+    m.e = e;
+    m.f = a->cell[0];
+    m.l = a->cell[1];
+    m.chunks = lpar_chunks(m.l->count);
+    m.out = keep ? malloc(sizeof(lval*) * (size_t)(m.l->count ? m.l->count : 1)) : NULL;
+    m.errs = calloc((size_t)(m.chunks ? m.chunks : 1), sizeof(lval*));
+
+    lpar_for(pmap_chunk, &m, m.chunks);
+
+    /* The first error in list order wins, the rest are dropped */
+    lval* err = NULL;
+    for (int c = 0; c < m.chunks; c++) {
+        if (!m.errs[c]) { continue; }
+        if (err) { lval_del(m.errs[c]); } else { err = m.errs[c]; }
+    }
+    free(m.errs);
+
+    lval* x = err;
+    if (keep) {
+        if (err) {
+            for (int i = 0; i < m.l->count; i++) { if (m.out[i]) { lval_del(m.out[i]); } }
+            free(m.out);
+        }
+        else {
+            x = lval_qexpr();
+            x->count = m.l->count;
+            x->cell = m.out;
+        }
+    }
+    if (!x) { x = lval_sexpr(); }
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+    LASSERT_NUM("pmap", a, 2);
+    LASSERT_TYPE("pmap", a, 0, LVAL_FUN);
+    LASSERT_TYPE("pmap", a, 1, LVAL_QEXPR);
+    return pmap_run(e, a, 1);
+}
+
+lval* builtin_pforeach(lenv* e, lval* a) {
+    LASSERT_NUM("pfor-each", a, 2);
+    LASSERT_TYPE("pfor-each", a, 0, LVAL_FUN);
+    LASSERT_TYPE("pfor-each", a, 1, LVAL_QEXPR);
+    return pmap_run(e, a, 0);
+}
+
+/* preduce: each task folds a contiguous run of l, then neighbouring
+   results are combined pairwise, a level at a time */
+typedef struct {
+    lenv* e;
+    lval* f;
+    lval* l;
+    lval** acc;   /* result of each run, then of each pair */
+    lval** out;   /* results of the pairs of a level */
+    lval** errs;
+    int chunks;
+} lpar_reduce;
+
+static void reduce_chunk(void* p, int c) {
+    lpar_reduce* r = p;
+    int n = r->l->count;
+    int lo = (int)((long long)n * c / r->chunks);
+    int hi = (int)((long long)n * (c + 1) / r->chunks);
+    lval* acc = lval_item(r->e, r->l, lo);
+    for (int i = lo + 1; i < hi && acc->type != LVAL_ERR; i++) {
+        lval* x = lval_item(r->e, r->l, i);
+        if (x->type == LVAL_ERR) { lval_del(acc); acc = x; break; }
+        acc = lval_call2(r->e, r->f, acc, x);
+    }
+    if (acc->type == LVAL_ERR) { r->errs[c] = acc; r->acc[c] = NULL; }
+    else { r->acc[c] = acc; }
+}
+
+static void reduce_pair(void* p, int i) {
+    lpar_reduce* r = p;
+    lval* x = lval_call2(r->e, r->f, r->acc[2 * i], r->acc[2 * i + 1]);
+    r->acc[2 * i] = r->acc[2 * i + 1] = NULL;
+    if (x->type == LVAL_ERR) { r->errs[i] = x; } else { r->out[i] = x; }
+}
+
+/* The first error in order wins, the rest and every result are dropped */
+static lval* reduce_errs(lpar_reduce* r, int n) {
+    lval* err = NULL;
+    for (int i = 0; i < n; i++) {
+        if (!r->errs[i]) { continue; }
+        if (err) { lval_del(r->errs[i]); } else { err = r->errs[i]; }
+        r->errs[i] = NULL;
+    }
+    if (err) {
+        for (int i = 0; i < r->chunks; i++) {
+            if (r->acc[i]) { lval_del(r->acc[i]); r->acc[i] = NULL; }
+        }
+    }
+    return err;
+}
+
+/* (preduce f z l) - foldl for an associative f, with z folded in once,
+   in front */
+lval* builtin_preduce(lenv* e, lval* a) {
+    LASSERT_NUM("preduce", a, 3);
+    LASSERT_TYPE("preduce", a, 0, LVAL_FUN);
+    LASSERT_TYPE("preduce", a, 2, LVAL_QEXPR);
+
+    lpar_reduce r;
+    r.e = e;
+    r.f = a->cell[0];
+    r.l = a->cell[2];
+    if (r.l->count == 0) { return lval_take(a, 1); }
+    r.chunks = lpar_chunks(r.l->count);
+    r.acc = calloc((size_t)r.chunks, sizeof(lval*));
+    r.out = calloc((size_t)r.chunks, sizeof(lval*));
+    r.errs = calloc((size_t)r.chunks, sizeof(lval*));
+
+    lpar_for(reduce_chunk, &r, r.chunks);
+    lval* x = reduce_errs(&r, r.chunks);
+    for (int n = r.chunks; !x && n > 1; n = (n + 1) / 2) {
+        lpar_for(reduce_pair, &r, n / 2);
+        /* An odd run out moves up with the pairs */
+        if (n % 2) { r.acc[n / 2] = r.acc[n - 1]; r.acc[n - 1] = NULL; }
+        for (int i = 0; i < n / 2; i++) { r.acc[i] = r.out[i]; r.out[i] = NULL; }
+        x = reduce_errs(&r, n / 2);
+    }
+    if (!x) { x = lval_call2(e, r.f, lval_copy(a->cell[1]), r.acc[0]); }
+    free(r.acc);
+    free(r.out);
+    free(r.errs);
+    lval_del(a);
+    return x;
+}
+
+/* sort and psort: a stable merge sort. Each task sorts a run of the
+   items, then neighbouring runs are merged pairwise, a level at a time.
+   Numbers alone in their natural order are radix sorted instead, see
+   sort_radix */
+typedef struct {
+    lenv* e;
+    lval* f;          /* less-than, NULL for the natural order */
+    char* func;
+    lval** v;
+    lval** tmp;
+    int* bounds;      /* runs left to merge */
+    lval** errs;
+    volatile long failed;
+} lsort;
+
+/* Order of numbers, then of strings, for sorts without a function */
+static int sort_natural(lsort* s, lval* x, lval* y, lval** err) {
+    if (x->type == LVAL_INUM && y->type == LVAL_INUM) { return x->inum < y->inum; }
+    if ((x->type == LVAL_INUM || x->type == LVAL_DNUM) &&
+        (y->type == LVAL_INUM || y->type == LVAL_DNUM)) {
+        double dx = x->type == LVAL_INUM ? (double)x->inum : x->dnum;
+        double dy = y->type == LVAL_INUM ? (double)y->inum : y->dnum;
+        return dx < dy;
+    }
+    if (x->type == LVAL_STR && y->type == LVAL_STR) { return strcmp(x->str, y->str) < 0; }
+    *err = lval_err("Function '%s' cannot order %s and %s.",
+        s->func, ltype_name(x->type), ltype_name(y->type));
+    return 0;
+}
+
+static int sort_less(lsort* s, lval* x, lval* y, lval** err) {
+    if (!s->f) { return sort_natural(s, x, y, err); }
+    lval* r = lval_call2(s->e, s->f, lval_copy(x), lval_copy(y));
+    int less = 0;
+    if (r->type == LVAL_ERR) { *err = r; return 0; }
+    if (r->type != LVAL_INUM && r->type != LVAL_DNUM) {
+        *err = lval_err("Function '%s' passed a comparison that returned %s.",
+            s->func, ltype_name(r->type));
+    }
+    else { less = lval_truthy(r); }
+    lval_del(r);
+    return less;
+}
+
+/* Merge v[lo, mid) and v[mid, hi), taking from the right only when it is
+   less, so equal items keep their order */
+static void sort_merge(lsort* s, int lo, int mid, int hi, lval** err) {
+    if (lo == mid || mid == hi) { return; }
+    if (!sort_less(s, s->v[mid], s->v[mid - 1], err)) { return; }
+    int i = lo, j = mid, k = lo;
+    while (i < mid && j < hi && !*err) {
+        if (sort_less(s, s->v[j], s->v[i], err)) { s->tmp[k++] = s->v[j++]; }
+        else { s->tmp[k++] = s->v[i++]; }
+    }
+    if (*err) { return; }
+    while (i < mid) { s->tmp[k++] = s->v[i++]; }
+    while (j < hi) { s->tmp[k++] = s->v[j++]; }
+    memcpy(s->v + lo, s->tmp + lo, sizeof(lval*) * (hi - lo));
+}
+
+static void sort_range(lsort* s, int lo, int hi, lval** err) {
+    if (hi - lo < 2 || s->failed) { return; }
+    int mid = lo + (hi - lo) / 2;
+    sort_range(s, lo, mid, err);
+    if (!*err) { sort_range(s, mid, hi, err); }
+    if (!*err) { sort_merge(s, lo, mid, hi, err); }
+    if (*err) { th_atomic_add(&s->failed, 1); }
+}
+
+static void sort_chunk(void* p, int c) {
+    lsort* s = p;
+    sort_range(s, s->bounds[c], s->bounds[c + 1], &s->errs[c]);
+}
+
+static void sort_pair(void* p, int i) {
+    lsort* s = p;
+    int* b = s->bounds;
+    sort_merge(s, b[2 * i], b[2 * i + 1], b[2 * i + 2], &s->errs[i]);
+    if (s->errs[i]) { th_atomic_add(&s->failed, 1); }
+}
+
+/* Radix keys ordered as the numbers are, see radix_sort */
+static uint64_t radix_key(lval* x) {
+    if (x->type == LVAL_INUM) { return (uint64_t)(int64_t)x->inum ^ (1ULL << 63); }
+    uint64_t u;
+    memcpy(&u, &x->dnum, sizeof(u));
+    return (u >> 63) ? ~u : u | (1ULL << 63);
+}
+
+/* Numbers of one type are interchangeable, so they are sorted as keys
+   and written back in order. Digits all keys share are skipped */
+static void radix_sort(lval** v, int n) {
+    uint64_t* k = malloc(sizeof(uint64_t) * n);
+    uint64_t* t = malloc(sizeof(uint64_t) * n);
+    for (int i = 0; i < n; i++) { k[i] = radix_key(v[i]); }
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        int count[256] = { 0 };
+        for (int i = 0; i < n; i++) { count[(k[i] >> shift) & 0xFF]++; }
+        if (count[(k[0] >> shift) & 0xFF] == n) { continue; }
+        int at = 0;
+        for (int d = 0; d < 256; d++) { int c = count[d]; count[d] = at; at += c; }
+        for (int i = 0; i < n; i++) { t[count[(k[i] >> shift) & 0xFF]++] = k[i]; }
+        uint64_t* x = k; k = t; t = x;
+    }
+
+    int dbl = v[0]->type == LVAL_DNUM;
+    for (int i = 0; i < n; i++) {
+        if (!dbl) { v[i]->inum = (intptr_t)(int64_t)(k[i] ^ (1ULL << 63)); continue; }
+        uint64_t u = (k[i] >> 63) ? k[i] ^ (1ULL << 63) : ~k[i];
+        memcpy(&v[i]->dnum, &u, sizeof(u));
+    }
+    free(k);
+    free(t);
+}
+
+/* Integers compared by < and the like, which go through double, keep
+   their order up to this magnitude */
+#define SORT_EXACT ((intptr_t)1 << 53)
+
+/* 1 to radix sort v ascending, -1 descending, 0 if it does not apply.
+   It applies where it gives what the merge sort would: the order is the
+   natural one, or < <= > >= on numbers, the items are all integers or
+   all decimals, and items that compare equal are the same number. So no
+   NaN, no 0.0 beside -0.0, and for < and the like no integer past
+   SORT_EXACT */
+static int sort_radix(lval* f, lval** v, int n) {
+    int dir = 1;
+    if (f) {
+        if (f->builtin == builtin_lt || f->builtin == builtin_le) { dir = 1; }
+        else if (f->builtin == builtin_gt || f->builtin == builtin_ge) { dir = -1; }
+        else { return 0; }
+    }
+    int t = v[0]->type;
+    if (t != LVAL_INUM && t != LVAL_DNUM) { return 0; }
+    int zeros = 0;    /* 1 for 0.0 seen, 2 for -0.0 */
+    for (int i = 0; i < n; i++) {
+        lval* x = v[i];
+        if (x->type != t) { return 0; }
+        if (t == LVAL_INUM) {
+            if (f && (x->inum > SORT_EXACT || x->inum < -SORT_EXACT)) { return 0; }
+        }
+        else if (isnan(x->dnum)) { return 0; }
+        else if (x->dnum == 0) {
+            zeros |= signbit(x->dnum) ? 2 : 1;
+            if (zeros == 3) { return 0; }
+        }
+    }
+    return dir;
+}
+
+static lval* sort_run(lenv* e, lval* a, char* func, int par) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function '%s' passed incorrect number of arguments. "
+        "Got %i, Expected 1 or 2.", func, a->count);
+    if (a->count == 2) { LASSERT_TYPE(func, a, 0, LVAL_FUN); }
+    int last = a->count - 1;
+    LASSERT_TYPE2(func, a, last, LVAL_QEXPR, LVAL_VEC);
+
+    /* The items of a list are evaluated as map does, those of a vector
+       copied into a new one */
+    lval* f = a->count == 2 ? lval_pop(a, 0) : NULL;
+    lval* x = lval_take(a, 0);
+    lval** v;
+    int n;
+    if (x->type == LVAL_VEC) {
+        lval* y = lval_vec(x->vec->count);
+        for (int i = 0; i < x->vec->count; i++) { y->vec->items[i] = lval_copy(x->vec->items[i]); }
+        y->vec->count = x->vec->count;
+        lval_del(x);
+        x = y;
+        v = x->vec->items;
+        n = x->vec->count;
+    }
+    else {
+        v = x->cell;
+        n = x->count;
+        for (int i = 0; i < n; i++) {
+            v[i] = lval_eval(e, v[i]);
+            if (v[i]->type == LVAL_ERR) {
+                lval* err = lval_pop(x, i);
+                lval_del(x);
+                if (f) { lval_del(f); }
+                return err;
+            }
+        }
+    }
+    if (n < 2) {
+        if (f) { lval_del(f); }
+        return x;
+    }
+
+    int dir = sort_radix(f, v, n);
+    if (dir) {
+        radix_sort(v, n);
+        for (int i = 0, j = n - 1; dir < 0 && i < j; i++, j--) {
+            lval* t = v[i]; v[i] = v[j]; v[j] = t;
+        }
+        if (f) { lval_del(f); }
+        return x;
+    }
+
+    lsort s;
+    s.e = e;
+    s.f = f;
+    s.func = func;
+    s.v = v;
+    s.tmp = malloc(sizeof(lval*) * (size_t)n);
+    s.failed = 0;
+    int chunks = par ? lpar_chunks(n) : 1;
+    s.bounds = malloc(sizeof(int) * ((size_t)chunks + 1));
+    for (int c = 0; c <= chunks; c++) { s.bounds[c] = (int)((long long)n * c / chunks); }
+    s.errs = calloc((size_t)chunks, sizeof(lval*));
+
+    lpar_for(sort_chunk, &s, chunks);
+    for (int k = chunks; !s.failed && k > 1; k = (k + 1) / 2) {
+        lpar_for(sort_pair, &s, k / 2);
+        /* Pairs become one run each, an odd one out stays as it is */
+        for (int i = 0; i < k / 2; i++) { s.bounds[i + 1] = s.bounds[2 * i + 2]; }
+        if (k % 2) { s.bounds[k / 2 + 1] = s.bounds[k]; }
+    }
+
+    lval* err = NULL;
+    for (int c = 0; c < chunks; c++) {
+        if (!s.errs[c]) { continue; }
+        if (err) { lval_del(s.errs[c]); } else { err = s.errs[c]; }
+    }
+    free(s.errs);
+    free(s.bounds);
+    free(s.tmp);
+    if (f) { lval_del(f); }
+    if (err) {
+        lval_del(x);
+        return err;
+    }
+    return x;
+}
+
+/* (sort l) or (sort f l) - l ordered by the less-than f, numbers and
+   strings in their natural order without it */
+lval* builtin_sort(lenv* e, lval* a) {
+    return sort_run(e, a, "sort", 0);
+}
+
+lval* builtin_psort(lenv* e, lval* a) {
+    return sort_run(e, a, "psort", 1);
+}
+
+/* Futures. (future {expr}) evaluates expr on a worker while the caller
+   goes on, (touch f) waits for the value. Each worker has a deque of the
+   futures it made: it pushes and pops the newest at the bottom, idle
+   threads steal the oldest from the top of the others. Threads that are
+   not workers share deque 0 */
+
+enum { FUT_QUEUED, FUT_RUNNING, FUT_DONE };
+
+struct lfut {
+    volatile long state;
+    volatile long refs;   /* copies of the lval, and the deque entry */
+    lval* expr;           /* until it runs */
+    lenv* env;            /* the locals expr names, copied when made */
+    lispy_ctx ctx;        /* task it runs in */
+    lispy_ctx* root;      /* interpreter waiting for it, see lpar_quiesce */
+    lval* val;
+};
+
+typedef struct {
+    th_mutex lock;
+    lfut** items;
+    int top;
+    int bottom;
+    int cap;
+} fut_deque;
+
+static struct {
+    fut_deque* deques;
+    int count;               /* workers plus one */
+    int workers;
+    th_mutex lock;
+    th_cond wake;            /* a future was queued or finished */
+    volatile long queued;    /* futures not yet claimed */
+    volatile long sleepers;
+    volatile long state;     /* 0 new, 1 starting, 2 ready */
+} sched;
+
+static LTHREAD int sched_id;
+
+static void deque_push(fut_deque* d, lfut* f) {
+    th_mutex_lock(&d->lock);
+    if (d->bottom == d->cap) {
+        if (d->top > 0) {
+            memmove(d->items, d->items + d->top, sizeof(lfut*) * (d->bottom - d->top));
+            d->bottom -= d->top;
+            d->top = 0;
+        }
+        else {
+            d->cap = d->cap ? d->cap * 2 : 64;
+            d->items = realloc(d->items, sizeof(lfut*) * d->cap);
+        }
+    }
+    d->items[d->bottom++] = f;
+    th_mutex_unlock(&d->lock);
+}
+
+/* The newest entry, if it is f (or any entry for f NULL) */
+static lfut* deque_pop(fut_deque* d, lfut* f) {
+    lfut* x = NULL;
+    th_mutex_lock(&d->lock);
+    if (d->bottom > d->top && (!f || d->items[d->bottom - 1] == f)) {
+        x = d->items[--d->bottom];
+        if (d->bottom == d->top) { d->top = d->bottom = 0; }
+    }
+    th_mutex_unlock(&d->lock);
+    return x;
+}
+
+static lfut* deque_steal(fut_deque* d) {
+    lfut* x = NULL;
+    th_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+        x = d->items[d->top++];
+        if (d->bottom == d->top) { d->top = d->bottom = 0; }
+    }
+    th_mutex_unlock(&d->lock);
+    return x;
+}
+
+/* Sleepers count themselves before checking, wakers change the state
+   before checking for sleepers, so no wakeup is lost */
+static void sched_notify(void) {
+    if (th_atomic_add(&sched.sleepers, 0) > 0) {
+        th_mutex_lock(&sched.lock);
+        th_cond_broadcast(&sched.wake);
+        th_mutex_unlock(&sched.lock);
+    }
+}
+
+/* Sleep until a future is queued, or *p holds v */
+static void sched_sleep(volatile long* p, long v) {
+    th_mutex_lock(&sched.lock);
+    th_atomic_add(&sched.sleepers, 1);
+    while (th_atomic_add(&sched.queued, 0) == 0 && !(p && th_atomic_add(p, 0) == v)) {
+        th_cond_wait(&sched.wake, &sched.lock);
+    }
+    th_atomic_add(&sched.sleepers, -1);
+    th_mutex_unlock(&sched.lock);
+}
+
+/* An entry from the thread's own deque, else one stolen from another */
+static lfut* sched_find(void) {
+    lfut* f = deque_pop(&sched.deques[sched_id], NULL);
+    for (int i = 1; !f && i < sched.count; i++) {
+        f = deque_steal(&sched.deques[(sched_id + i) % sched.count]);
+    }
+    return f;
+}
+
+/* Work a future still owes its root, see builtin_future */
+static void fut_unit(lispy_ctx* root) {
+    th_atomic_add(&lparallel, -1);
+    th_atomic_add(&root->live, -1);
+    sched_notify();
+}
+
+static void fut_free(lfut* f) {
+    /* Envs in the value are dropped as the task would */
+    lispy_ctx* saved = lctx;
+    lctx = &f->ctx;
+    if (f->val) { lval_del(f->val); }
+    if (f->ctx.pending) { ht_destroy(f->ctx.pending); }
+    lctx = saved;
+    free(f);
+}
+
+void lfut_retain(lfut* f) {
+    th_atomic_add(&f->refs, 1);
+}
+
+void lfut_release(lfut* f) {
+    if (th_atomic_add(&f->refs, -1) == 0) { fut_free(f); }
+}
+
+/* Evaluate a future claimed by the calling thread */
+static void fut_eval(lfut* f) {
+    lispy_ctx* saved = lctx;
+    lctx = &f->ctx;
+    f->val = builtin_eval(f->env, lval_add(lval_sexpr(), f->expr));
+    f->expr = NULL;
+    lenv_release(f->env);
+    f->env = NULL;
+    lctx = saved;
+    th_atomic_add(&f->state, FUT_DONE - FUT_RUNNING);
+    sched_notify();
+}
+
+static int fut_claim(lfut* f) {
+    if (!th_atomic_cas(&f->state, FUT_QUEUED, FUT_RUNNING)) { return 0; }
+    th_atomic_add(&sched.queued, -1);
+    return 1;
+}
+
+/* Run the future of a deque entry unless someone claimed it first, then
+   drop the entry */
+static void sched_run(lfut* f) {
+    lispy_ctx* root = f->root;
+    if (fut_claim(f)) {
+        fut_eval(f);
+        fut_unit(root);
+    }
+    lfut_release(f);
+    fut_unit(root);
+}
+
+static void sched_worker(void* arg) {
+    sched_id = (int)(intptr_t)arg;
+    for (;;) {
+        lfut* f = sched_find();
+        if (f) { sched_run(f); }
+        else { sched_sleep(NULL, 0); }
+    }
+}
+
+/* Workers are started on first use, one per core besides the caller */
+static void sched_start(void) {
+    if (th_atomic_load(&sched.state) == 2) { return; }
+    if (th_atomic_cas(&sched.state, 0, 1)) {
+        lpar_start();
+        int n = th_cpu_count() - 1;
+        sched.count = n + 1;
+        sched.deques = calloc(sched.count, sizeof(fut_deque));
+        for (int i = 0; i < sched.count; i++) { th_mutex_init(&sched.deques[i].lock); }
+        th_mutex_init(&sched.lock);
+        th_cond_init(&sched.wake);
+        for (int i = 1; i <= n; i++) {
+            th_thread t;
+            if (th_thread_create(&t, sched_worker, (void*)(intptr_t)i) != 0) { break; }
+            sched.workers++;
+        }
+        th_atomic_add(&sched.state, 1);
+    }
+    while (th_atomic_add(&sched.state, 0) != 2) { th_yield(); }
+}
+
+lval* lfut_value(lfut* f) {
+    if (th_atomic_add(&f->state, 0) == FUT_DONE) { return f->val; }
+
+    /* Not started: run it here, taking back its entry if it is the last
+       one this thread queued */
+    if (fut_claim(f)) {
+        lispy_ctx* root = f->root;
+        int own = deque_pop(&sched.deques[sched_id], f) != NULL;
+        fut_eval(f);
+        fut_unit(root);
+        if (own) {
+            lfut_release(f);
+            fut_unit(root);
+        }
+        return f->val;
+    }
+
+    /* Running elsewhere: run other futures meanwhile */
+    while (th_atomic_add(&f->state, 0) != FUT_DONE) {
+        lfut* g = sched_find();
+        if (g) { sched_run(g); }
+        else { sched_sleep(&f->state, FUT_DONE); }
+    }
+    return f->val;
+}
+
+void lpar_quiesce(void) {
+    lispy_ctx* c = lctx;
+    if (c->parent) { return; }
+    while (th_atomic_add(&c->live, 0) > 0) {
+        lfut* f = sched_find();
+        if (f) { sched_run(f); }
+        else { sched_sleep(&c->live, 0); }
+    }
+    lpar_settle(c);
+}
+
+/* Copy the locals x names from e into the env of a future */
+static void fut_capture(lenv* e, lenv* env, lval* x) {
+    if (x->type == LVAL_SYM) {
+        lval* v = lenv_local(e, x);
+        if (v && !lenv_local(env, x)) { lenv_put(env, x, v); }
+    }
+    else if (x->type == LVAL_SEXPR || x->type == LVAL_QEXPR) {
+        for (int i = 0; i < x->count; i++) { fut_capture(e, env, x->cell[i]); }
+    }
+}
+
+lval* builtin_future(lenv* e, lval* a) {
+    LASSERT_NUM("future", a, 1);
+    LASSERT_TYPE("future", a, 0, LVAL_QEXPR);
+    sched_start();
+
+    /* The future runs in a task of the interpreter at the root, with the
+       globals of it and a copy of the locals it names */
+    lispy_ctx* root = lctx->parent ? lctx->parent : lctx;
+    lfut* f = malloc(sizeof(lfut));
+    f->state = FUT_QUEUED;
+    f->refs = 1;
+    f->expr = lval_take(a, 0);
+    f->root = root;
+    f->val = NULL;
+    f->ctx = *lctx;
+    f->ctx.parent = root;
+    f->ctx.pending = NULL;
+    f->ctx.live = 0;
+    rng_seed(&f->ctx.rng, rng_next(&lctx->rng));
+
+    lispy_ctx* saved = lctx;
+    lctx = &f->ctx;
+    f->env = lenv_new();
+    fut_capture(e, f->env, f->expr);
+    lctx = saved;
+
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_FUT;
+    v->fut = f;
+
+    /* Without workers it is evaluated right away */
+    if (sched.workers == 0) {
+        f->state = FUT_RUNNING;
+        fut_eval(f);
+        return v;
+    }
+
+    /* The entry holds a reference. The root and the reference counts stay
+       shared until both the entry is dropped and the future has run */
+    f->refs = 2;
+    th_atomic_add(&root->live, 2);
+    th_atomic_add(&lparallel, 2);
+    deque_push(&sched.deques[sched_id], f);
+    th_atomic_add(&sched.queued, 1);
+    sched_notify();
+    return v;
+}
+
+lval* builtin_touch(lenv* e, lval* a) {
+    LASSERT_NUM("touch", a, 1);
+    if (a->cell[0]->type != LVAL_FUT) { return lval_take(a, 0); }
+    lfut* f = a->cell[0]->fut;
+    lval* x = lval_copy(lfut_value(f));
+
+    /* The names it bound locally are passed on once */
+    th_mutex_lock(&sched.lock);
+    ht* p = f->ctx.pending;
+    f->ctx.pending = NULL;
+    th_mutex_unlock(&sched.lock);
+    if (p) { lpar_merge(lctx, p); }
+
+    lval_del(a);
+    return x;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef _PAR_H
+#define _PAR_H
+
+#include "lsp.h"
+
+/* Task of lpar_for, i goes from 0 to n-1 */
+typedef void (*lpar_fn)(void* arg, int i);
+
+/* Run fn(arg, i) for every i in [0, n) on the worker pool and wait for
+   all of them. Each runs in a task: a copy of the calling interpreter
+   that reads its globals and changes none. Inside a task this runs the
+   calls inline */
+void lpar_for(lpar_fn fn, void* arg, int n);
+
+/* Number of tasks to split n items into */
+int lpar_chunks(int n);
+
+lval* builtin_pmap(lenv* e, lval* a);
+lval* builtin_pforeach(lenv* e, lval* a);
+lval* builtin_preduce(lenv* e, lval* a);
+lval* builtin_sort(lenv* e, lval* a);
+lval* builtin_psort(lenv* e, lval* a);
+lval* builtin_future(lenv* e, lval* a);
+lval* builtin_touch(lenv* e, lval* a);
+
+#endif
@@ -99,36 +99,93 @@
 (defun {snd l} { eval (head (tail l)) })
 (defun {trd l} { eval (head (tail (tail l))) })
 
-; List Length
-(defun {len l} {
-  if (== l nil)
-    {0}
-    {+ 1 (len (tail l))}
-})
-
-; Nth item in List
-(defun {nth n l} {
-  if (== n 0)
-    {fst l}
-    {nth (- n 1) (tail l)}
-})
-
-; Last item in List
-(defun {last l} {nth (- (len l) 1) l})
-
-; Apply function to List
-(defun {map f l} {
-  if (== l nil)
-    {nil}
-    {join (list (f (fst l))) (map f (tail l))}
+; These are builtins, the Lisp versions below replace them
+; when lispy is started with --lisp-lists
+(if native-lists {} {do
+  ; List Length
+  (defun {len l} {
+    if (== l nil)
+      {0}
+      {+ 1 (len (tail l))}
+  })
+
+  ; Nth item in List
+  (defun {nth n l} {
+    if (== n 0)
+      {fst l}
+      {nth (- n 1) (tail l)}
+  })
+
+  ; Last item in List
+  (defun {last l} {nth (- (len l) 1) l})
+
+  ; Apply function to List
+  (defun {map f l} {
+    if (== l nil)
+      {nil}
+      {join (list (f (fst l))) (map f (tail l))}
+  })
+
+  ; Apply Filter to List
+  (defun {filter f l} {
+    if (== l nil)
+      {nil}
+      {join (if (f (fst l)) {head l} {nil}) (filter f (tail l))}
+  })
+
+  ; Reverse List
+  (defun {reverse l} {
+    if (== l nil)
+      {nil}
+      {join (reverse (tail l)) (head l)}
+  })
+
+  ; Fold Left
+  (defun {foldl f z l} {
+    if (== l nil) 
+      {z}
+      {foldl f (f z (fst l)) (tail l)}
+  })
+
+  ; Fold Right
+  (defun {foldr f z l} {
+    if (== l nil) 
+      {z}
+      {f (fst l) (foldr f z (tail l))}
+  })
+
+  (defun {sum l} {foldl + 0 l})
+
+  ; Take N items
+  (defun {take n l} {
+    if (== n 0)
+      {nil}
+      {join (head l) (take (- n 1) (tail l))}
+  })
+
+  ; Drop N items
+  (defun {drop n l} {
+    if (== n 0)
+      {l}
+      {drop (- n 1) (tail l)}
+  })
+
+  ; Element of List
+  (defun {elem x l} {
+    if (== l nil)
+      {false}
+      {if (== x (fst l)) {true} {elem x (tail l)}}
+  })
+
+  ; Zip two lists together into a list of pairs
+  (defun {zip x y} {
+    if (or (== x nil) (== y nil))
+      {nil}
+      {join (list (join (head x) (head y))) (zip (tail x) (tail y))}
+  })
 })
 
-; Apply Filter to List
-(defun {filter f l} {
-  if (== l nil)
-    {nil}
-    {join (if (f (fst l)) {head l} {nil}) (filter f (tail l))}
-})
+(defun {product l} {foldl * 1 l})
 
 ; Return all of list but last element
 (defun {init l} {
@@ -137,44 +194,6 @@
     {join (head l) (init (tail l))}
 })
 
-; Reverse List
-(defun {reverse l} {
-  if (== l nil)
-    {nil}
-    {join (reverse (tail l)) (head l)}
-})
-
-; Fold Left
-(defun {foldl f z l} {
-  if (== l nil) 
-    {z}
-    {foldl f (f z (fst l)) (tail l)}
-})
-
-; Fold Right
-(defun {foldr f z l} {
-  if (== l nil) 
-    {z}
-    {f (fst l) (foldr f z (tail l))}
-})
-
-(defun {sum l} {foldl + 0 l})
-(defun {product l} {foldl * 1 l})
-
-; Take N items
-(defun {take n l} {
-  if (== n 0)
-    {nil}
-    {join (head l) (take (- n 1) (tail l))}
-})
-
-; Drop N items
-(defun {drop n l} {
-  if (== n 0)
-    {l}
-    {drop (- n 1) (tail l)}
-})
-
 ; Split at N
 (defun {split n l} {list (take n l) (drop n l)})
 
@@ -192,13 +211,6 @@
     {drop-while f (tail l)}
 })
 
-; Element of List
-(defun {elem x l} {
-  if (== l nil)
-    {false}
-    {if (== x (fst l)) {true} {elem x (tail l)}}
-})
-
 ; Find element in list of pairs
 (defun {lookup x l} {
   if (== l nil)
@@ -210,13 +222,6 @@
     }
 })
 
-; Zip two lists together into a list of pairs
-(defun {zip x y} {
-  if (or (== x nil) (== y nil))
-    {nil}
-    {join (list (join (head x) (head y))) (zip (tail x) (tail y))}
-})
-
 ; Unzip a list of pairs into two lists
 (defun {unzip l} {
   if (== l nil)
@@ -270,6 +275,19 @@
     { otherwise (addb (bfib (subb n 1)) (bfib (subb n 2))) }
 })
 
+; The same with one branch in a future, serial below the cutoff
+(defun {pfib n} {
+  if (< n 15)
+    {fib n}
+    {do (= {a} (future {pfib (- n 1)})) (+ (pfib (- n 2)) (touch a))}
+})
+
+(defun {pbfib n} {
+  if (< (cmp-bnum n (to-bnum 15)) 0)
+    {bfib n}
+    {do (= {a} (future {pbfib (subb n 1)})) (addb (pbfib (subb n 2)) (touch a))}
+})
+
 ; Factorial
 (defun {fac n} {
   product (range 2 (inc n))
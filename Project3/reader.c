@@ -0,0 +1,438 @@
+#include "reader.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* A token: its type and where it sits in the buffer */
+typedef struct ltoken {
+    int type;
+    size_t start;
+    size_t len;
+    int line;
+    int col;
+} ltoken;
+
+void lreader_init(lreader* r, const char* name, const char* buf, size_t len) {
+    r->name = name;
+    r->buf = buf;
+    r->len = len;
+    r->pos = 0;
+    r->line = 1;
+    r->col = 1;
+    r->failed = 0;
+    r->in = NULL;
+    r->cap = 0;
+    r->mark = 0;
+    r->map = NULL;
+}
+
+void lreader_stream(lreader* r, const char* name, FILE* in) {
+    lreader_init(r, name, malloc(LREADCHUNK), 0);
+    r->in = in;
+    r->cap = LREADCHUNK;
+}
+
+void* lfile_map(const char* path, size_t* len) {
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (f == INVALID_HANDLE_VALUE) { return NULL; }
+
+    LARGE_INTEGER size;
+    void* p = NULL;
+    if (GetFileSizeEx(f, &size) && size.QuadPart > 0) {
+        HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m) {
+            p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+            /* The view keeps the mapping alive */
+            CloseHandle(m);
+        }
+        *len = (size_t)size.QuadPart;
+    }
+    CloseHandle(f);
+    return p;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return NULL; }
+
+    struct stat st;
+    void* p = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { p = NULL; }
+        else {
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            *len = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    return p;
+#endif
+}
+
+void lfile_unmap(void* p, size_t len) {
+#ifdef _WIN32
+    UnmapViewOfFile(p);
+#else
+    munmap(p, len);
+#endif
+}
+
+char* lfile_tmpname(const char* path) {
+    static volatile long made = 0;
+#ifdef _WIN32
+    unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    char* p = malloc(strlen(path) + 48);
+    sprintf(p, "%s.%lu.%ld.tmp", path, pid, th_atomic_add(&made, 1));
+    return p;
+}
+
+int lreader_open(lreader* r, const char* path) {
+    size_t len;
+    void* p = lfile_map(path, &len);
+    if (p) {
+        lreader_init(r, path, p, len);
+        r->map = p;
+        return 0;
+    }
+
+    /* Pipes, empty files and anything else that will not map */
+    FILE* f = fopen(path, "rb");
+    if (!f) { return -1; }
+    lreader_stream(r, path, f);
+    return 0;
+}
+
+void lreader_close(lreader* r) {
+    if (r->map) {
+        lfile_unmap(r->map, r->len);
+        r->map = NULL;
+    }
+    if (r->in) {
+        free((char*)r->buf);
+        fclose(r->in);
+        r->in = NULL;
+    }
+    r->buf = NULL;
+}
+
+/* Read more of the stream into the window. Bytes before the form being
+   read are dropped first, the window only grows for a larger form */
+static int more(lreader* r) {
+    if (!r->in || feof(r->in) || ferror(r->in)) { return 0; }
+
+    char* buf = (char*)r->buf;
+    if (r->mark) {
+        memmove(buf, buf + r->mark, r->len - r->mark);
+        r->len -= r->mark;
+        r->pos -= r->mark;
+        r->mark = 0;
+    }
+    if (r->len == r->cap) {
+        buf = realloc(buf, r->cap *= 2);
+        r->buf = buf;
+    }
+
+    size_t got = fread(buf + r->len, 1, r->cap - r->len, r->in);
+    r->len += got;
+    return got > 0;
+}
+
+/* Byte i past the read position, -1 at end of input */
+static int peek(lreader* r, size_t i) {
+    while (r->pos + i >= r->len) {
+        if (!more(r)) { return -1; }
+    }
+    return (unsigned char)r->buf[r->pos + i];
+}
+
+static int is_sym_char(int c) {
+    if (c == -1) { return 0; }
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || (c && strchr("_+-*/\\=<>!&%^?:", c));
+}
+
+static int is_digit(int c) {
+    return c >= '0' && c <= '9';
+}
+
+/* Move past n bytes, keeping line and column */
+static void advance(lreader* r, size_t n) {
+    for (; n && r->pos < r->len; n--) {
+        if (r->buf[r->pos++] == '\n') { r->line++; r->col = 1; }
+        else { r->col++; }
+    }
+}
+
+/* Syntax error at line:col, the rest of the input is dropped */
+static lval* read_err(lreader* r, int line, int col, char* msg, int c) {
+    r->failed = 1;
+    if (c) {
+        return lval_err("%s:%d:%d: %s '%c'", r->name, line, col, msg, c);
+    }
+    return lval_err("%s:%d:%d: %s", r->name, line, col, msg);
+}
+
+/* Skip whitespace and comments, return the next byte. Between
+   top-level forms the skipped bytes can leave the window at once */
+static int skip_space(lreader* r, int top) {
+    int c;
+    for (;;) {
+        if (top) { r->mark = r->pos; }
+        if ((c = peek(r, 0)) == -1) { break; }
+
+        if (c == ';') {
+            while ((c = peek(r, 0)) != -1 && c != '\n' && c != '\r') {
+                r->pos++;
+                r->col++;
+                if (top) { r->mark = r->pos; }
+            }
+        }
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+            c == '\f' || c == '\v') {
+            advance(r, 1);
+        }
+        else { break; }
+    }
+    return c;
+}
+
+static void lex(lreader* r, ltoken* t) {
+    int c = skip_space(r, 0);
+    t->line = r->line;
+    t->col = r->col;
+    if (c == -1) { t->type = TOK_EOF; t->start = r->pos; t->len = 0; return; }
+
+    size_t n = 1;
+    switch (c) {
+    case '(': t->type = TOK_LPAREN; break;
+    case ')': t->type = TOK_RPAREN; break;
+    case '{': t->type = TOK_LBRACE; break;
+    case '}': t->type = TOK_RBRACE; break;
+    case ']': t->type = TOK_RBRACKET; break;
+    case '#':
+        c = peek(r, 1);
+        if (c == '{') { t->type = TOK_MAP; n = 2; }
+        else if (c == '[') { t->type = TOK_VEC; n = 2; }
+        else { t->type = TOK_BAD; }
+        break;
+    case '"':
+        /* Runs to the next unescaped quote */
+        while ((c = peek(r, n)) != -1 && c != '"') {
+            n += (c == '\\' && peek(r, n + 1) != -1) ? 2 : 1;
+        }
+        if (c == -1) { t->type = TOK_BAD; }
+        else { t->type = TOK_STR; n++; }
+        break;
+    default:
+        if (is_digit(c) || (c == '-' && is_digit(peek(r, 1)))) {
+            /* -?[0-9]+ with an optional .[0-9]+ */
+            while (is_digit(peek(r, n))) { n++; }
+            t->type = TOK_INUM;
+            if (peek(r, n) == '.' && is_digit(peek(r, n + 1))) {
+                n++;
+                while (is_digit(peek(r, n))) { n++; }
+                t->type = TOK_DNUM;
+            }
+        }
+        else if (is_sym_char(c)) {
+            while (is_sym_char(peek(r, n))) { n++; }
+            t->type = TOK_SYM;
+        }
+        else { t->type = TOK_BAD; }
+    }
+
+    /* Refilling may have moved the window, so locate the token last */
+    t->start = r->pos;
+    t->len = n;
+    advance(r, n);
+}
+
+/* NUL terminated copy of a token, in buf when it fits */
+static char* token_text(lreader* r, ltoken* t, char* buf, size_t size) {
+    char* s = t->len < size ? buf : malloc(t->len + 1);
+    memcpy(s, r->buf + t->start, t->len);
+    s[t->len] = '\0';
+    return s;
+}
+
+lval* lreader_sym(const char* s) {
+    /* A leading ':' belongs to the package name, as in ":LSPY:sym" */
+    const char* c = strchr(s + (s[0] == ':'), ':');
+    if (!c || !c[1]) { return lval_sym((char*)s); }
+
+    size_t n = (size_t)(c - s);
+    char* name = malloc(n + 1);
+    memcpy(name, s, n);
+    name[n] = '\0';
+    pack* p = pack_find(name);
+    free(name);
+    if (!p) { return NULL; }
+
+    lval* x = lval_sym((char*)s);
+    x->pkg = p;
+    return x;
+}
+
+static lval* read_sym(lreader* r, ltoken* t, char* s) {
+    lval* x = lreader_sym(s);
+    if (!x) {
+        /* Stops a load like any other syntax error */
+        r->failed = 1;
+        return lval_err("%s:%d:%d: Unknown package in '%s'",
+            r->name, t->line, t->col, s);
+    }
+    return x;
+}
+
+static lval* read_atom(lreader* r, ltoken* t) {
+    char buf[64];
+    char* s;
+    lval* x;
+
+    switch (t->type) {
+    case TOK_INUM:
+        s = token_text(r, t, buf, sizeof(buf));
+        errno = 0;
+        long i = strtol(s, NULL, 10);
+        x = errno != ERANGE ? lval_inum(i) : lval_err("invalid number");
+        break;
+    case TOK_DNUM:
+        s = token_text(r, t, buf, sizeof(buf));
+        errno = 0;
+        double d = strtod(s, NULL);
+        x = errno != ERANGE ? lval_dnum(d) : lval_err("invalid number");
+        break;
+    case TOK_SYM:
+        s = token_text(r, t, buf, sizeof(buf));
+        x = read_sym(r, t, s);
+        break;
+    default: {
+        /* Drop the quotes and unescape what is between them */
+        char* str = malloc(t->len - 1);
+        memcpy(str, r->buf + t->start + 1, t->len - 2);
+        str[t->len - 2] = '\0';
+        str = mpcf_unescape(str);
+        x = lval_str(str);
+        free(str);
+        return x;
+    }
+    }
+
+    if (s != buf) { free(s); }
+    return x;
+}
+
+static lval* read_form(lreader* r, ltoken* t);
+
+/* (copy x), so that every evaluation makes a new map or vector */
+static lval* lval_literal(lval* x) {
+    lval* lit = lval_sexpr();
+    lval_add(lit, lval_builtin(builtin_copy));
+    return lval_add(lit, x);
+}
+
+/* Literals nested in a literal are held as values, the copy of the
+   outer one copies them too */
+static void unwrap_literals(lval* x) {
+    for (int i = 0; i < x->count; i++) {
+        lval* y = x->cell[i];
+        if (y->type == LVAL_SEXPR && y->count == 2 && y->cell[0]->type == LVAL_FUN &&
+            y->cell[0]->builtin == builtin_copy) {
+            x->cell[i] = lval_take(y, 1);
+        }
+    }
+}
+
+/* The elements of a list up to the token that closes it */
+static lval* read_list(lreader* r, ltoken* open, int close) {
+    static const char* closers[] = { ")", "}", "]" };
+    const char* cl = closers[close == TOK_RPAREN ? 0 : close == TOK_RBRACE ? 1 : 2];
+
+    lval* x = open->type == TOK_LPAREN ? lval_sexpr() : lval_qexpr();
+    ltoken t;
+    for (lex(r, &t); t.type != close; lex(r, &t)) {
+        if (t.type == TOK_EOF) {
+            lval_del(x);
+            char msg[64];
+            snprintf(msg, sizeof(msg), "missing '%s' for the list opened here", cl);
+            return read_err(r, open->line, open->col, msg, 0);
+        }
+        lval* y = read_form(r, &t);
+        if (r->failed) { lval_del(x); return y; }
+        x = lval_add(x, y);
+    }
+
+    /* Map and vector literals hold their items unevaluated. Each is
+       built once, every evaluation of the literal copies it */
+    if (open->type == TOK_MAP) {
+        if (x->count % 2 != 0) {
+            lval_del(x);
+            return lval_err("Map literal has a key without a value.");
+        }
+        unwrap_literals(x);
+        return lval_literal(builtin_make_map(NULL, x));
+    }
+    if (open->type == TOK_VEC) {
+        unwrap_literals(x);
+        return lval_literal(builtin_list_to_vec(NULL, lval_add(lval_sexpr(), x)));
+    }
+
+    /* Lists headed by a symbol may be evaluated as calls */
+    if (x->count && x->cell[0]->type == LVAL_SYM) {
+        x->ic = lic_new();
+    }
+    return x;
+}
+
+static lval* read_form(lreader* r, ltoken* t) {
+    switch (t->type) {
+    case TOK_LPAREN: return read_list(r, t, TOK_RPAREN);
+    case TOK_LBRACE: return read_list(r, t, TOK_RBRACE);
+    case TOK_MAP:    return read_list(r, t, TOK_RBRACE);
+    case TOK_VEC:    return read_list(r, t, TOK_RBRACKET);
+    case TOK_INUM:
+    case TOK_DNUM:
+    case TOK_SYM:
+    case TOK_STR:    return read_atom(r, t);
+    case TOK_BAD:
+        if (r->buf[t->start] == '"') {
+            return read_err(r, t->line, t->col, "unterminated string", 0);
+        }
+        return read_err(r, t->line, t->col, "unexpected character",
+            r->buf[t->start]);
+    default:
+        return read_err(r, t->line, t->col, "unexpected",
+            r->buf[t->start]);
+    }
+}
+
+lval* lreader_next(lreader* r) {
+    if (r->failed) { return NULL; }
+
+    /* Everything before this form may be dropped from the window */
+    ltoken t;
+    skip_space(r, 1);
+    lex(r, &t);
+    if (t.type == TOK_EOF) { return NULL; }
+    return read_form(r, &t);
+}
+
+lval* lreader_all(lreader* r) {
+    lval* x = lval_sexpr();
+    lval* y;
+    while ((y = lreader_next(r))) {
+        if (r->failed) { lval_del(x); return y; }
+        x = lval_add(x, y);
+    }
+    return x;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef _READER_H
+#define _READER_H
+
+#include "lsp.h"
+
+/* Initial window of a streaming reader, it grows to fit a larger form */
+#define LREADCHUNK (64 * 1024)
+
+/* Reads lvals straight from a byte buffer, one form at a time. A
+   file is either mapped whole into buf or, when it cannot be mapped,
+   streamed through a window of it */
+typedef struct lreader {
+    const char* name;  /* file name used in error messages */
+    const char* buf;
+    size_t len;
+    size_t pos;
+    int line;          /* position of buf[pos], from 1 */
+    int col;
+    int failed;        /* set by a syntax error */
+    FILE* in;          /* stream refilling buf, or NULL */
+    size_t cap;        /* size of the window */
+    size_t mark;       /* start of the form being read */
+    void* map;         /* buf when it is a mapped file */
+} lreader;
+
+/* Token types */
+enum {
+    TOK_EOF = 0, TOK_LPAREN, TOK_RPAREN, TOK_LBRACE, TOK_RBRACE,
+    TOK_MAP, TOK_VEC, TOK_RBRACKET, TOK_INUM, TOK_DNUM, TOK_SYM, TOK_STR,
+    TOK_BAD
+};
+
+void lreader_init(lreader* r, const char* name, const char* buf, size_t len);
+
+/* Read from a stream a window at a time, free it with lreader_close */
+void lreader_stream(lreader* r, const char* name, FILE* in);
+
+/* Read the file at path, mapped if possible. Return 0, or -1 with errno
+   set if it cannot be opened. Release it with lreader_close */
+int lreader_open(lreader* r, const char* path);
+void lreader_close(lreader* r);
+
+/* Map a regular file read-only, NULL if it cannot be mapped */
+void* lfile_map(const char* path, size_t* len);
+void lfile_unmap(void* p, size_t len);
+
+/* path with a suffix no other writer in or out of the process is using,
+   for a file written aside and renamed into place */
+char* lfile_tmpname(const char* path);
+
+/* Next top-level form, NULL at end of input. A syntax error is returned
+   as an error lval and ends the input */
+lval* lreader_next(lreader* r);
+
+/* Every remaining form in an s-expression, or the first error */
+lval* lreader_all(lreader* r);
+
+/* The symbol s as the reader makes it: pkg:sym names sym in package
+   pkg, ":LSPY:sym" names it in the root package, anything else belongs
+   to the current package. NULL if pkg does not exist */
+lval* lreader_sym(const char* s);
+
+#endif
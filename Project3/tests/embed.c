@@ -0,0 +1,66 @@
+/* Embedding checks. Build with the interpreter sources and LISPY_EMBED
+   defined, run from Project3, e.g.
+       cc -DLISPY_EMBED *.c tests/embed.c -lm -lpthread -o embed-test
+   It exits non-zero and names the check when one fails */
+
+#include <stdio.h>
+#include <string.h>
+#include "../lispy.h"
+
+static int failed = 0;
+
+#define CHECK(cond, name) \
+    if (!(cond)) { printf("FAIL %s\n", name); failed = 1; }
+
+/* A closure handed to the host is freed outside of any call into the
+   interpreter */
+static void free_closure(void) {
+    lispy_ctx* c = lispy_open();
+    lval* f = lispy_eval_string(c, "(\\ {x} {* x 3})");
+    CHECK(lispy_type(f) == LISPY_FUN, "closure returned");
+    lval* g = lispy_copy(f);
+    lispy_free(f);
+    lval* x = lispy_call(c, g, lispy_push(lispy_list(), lispy_int(2)));
+    CHECK(lispy_to_int(x) == 6, "copy outlives the original");
+    lispy_free(x);
+    lispy_free(g);
+    lispy_close(c);
+}
+
+static lval* twice(lenv* e, lval* args) {
+    (void)e;
+    intptr_t x = lispy_to_int(lispy_item(args, 0));
+    lispy_free(args);
+    return lispy_int(2 * x);
+}
+
+/* A registered native stays behind when a function is spawned or a
+   value holding it is sent */
+static void spawn_after_register(void) {
+    lispy_ctx* c = lispy_open();
+    lispy_register(c, "twice", twice);
+    lval* x = lispy_eval_string(c,
+        "(chan-recv (spawn (\\ {x} {+ x 1}) 41))");
+    CHECK(lispy_to_int(x) == 42, "spawn after lispy_register");
+    lispy_free(x);
+    x = lispy_eval_string(c,
+        "(chan-recv (spawn (\\ {} {twice 1})))");
+    CHECK(lispy_type(x) == LISPY_ERR, "native unbound when spawned");
+    lispy_free(x);
+    x = lispy_eval_string(c,
+        "(def {ch} (make-chan 1)) (chan-send ch (list 1 twice)) (chan-recv ch)");
+    CHECK(lispy_count(x) == 2 && lispy_to_int(lispy_item(x, 0)) == 1 &&
+        lispy_count(lispy_item(x, 1)) == 0, "native sent as ()");
+    lispy_free(x);
+    x = lispy_eval_string(c, "(twice 4)");
+    CHECK(lispy_to_int(x) == 8, "native still bound");
+    lispy_free(x);
+    lispy_close(c);
+}
+
+int main(void) {
+    free_closure();
+    spawn_after_register();
+    if (!failed) { printf("ok\n"); }
+    return failed;
+}
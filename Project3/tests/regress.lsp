@@ -0,0 +1,105 @@
+;;;
+;;;   Regression checks, run from Project3 with
+;;;       lispy prelude.lsp tests/regress.lsp
+;;;   Each failing check prints FAIL, its name, and what it got. The
+;;;   errors printed come from checks of what should fail
+;;;
+
+(defun {check name got want} {
+  if (== got want)
+    {()}
+    {print "FAIL" name got}
+})
+
+;;; Doubles too large for an integer hash as themselves
+(def {big} (^ 10.0 300))
+(def {inf} (^ 10.0 400))
+(def {huge} (make-map big "big" inf "inf"))
+(check "map keyed by huge doubles" (list (map-get huge big 0) (map-get huge inf 0)) {"big" "inf"})
+
+;;; A map literal makes a new map each time it is evaluated
+(defun {newmap x} {#{}})
+(map-put (newmap 0) 1 2)
+(check "map literal is not shared" (map-len (newmap 0)) 0)
+(defun {nested x} {#{1 #{}}})
+(map-put (map-get (nested 0) 1) 2 3)
+(check "nested map literal is not shared" (map-len (map-get (nested 0) 1)) 0)
+
+;;; So does a vector literal
+(defun {newvec x} {#[]})
+(vec-push (newvec 0) 1)
+(check "vector literal is not shared" (vec-len (newvec 0)) 0)
+(defun {vecs x} {#[#[] #{}]})
+(vec-push (vec-ref (vecs 0) 0) 1)
+(check "nested vector literal is not shared" (vec-len (vec-ref (vecs 0) 0)) 0)
+
+;;; Nothing can be stored inside itself, the attempts print errors
+(def {v} (list->vec {1}))
+(vec-push v v)
+(vec-set! v 0 (list v))
+(def {w} (list->vec {2}))
+(vec-push w v)
+(vec-push v w)
+(vec-push v ((\ {a b} {a}) v))
+(check "vector left alone" (vec->list v) {1})
+(print v w)
+(def {m} (make-map 1 2))
+(map-put m m 3)
+(map-put m 3 (list m))
+(check "map left alone" (map-len m) 1)
+
+;;; The native filter reports a bad predicate result as the prelude did
+(filter (\ {x} {"s"}) {1 2})
+;;; and like the prelude's list functions returns an item's error
+(map (\ {x} {1}) {(/ 1 0) 2})
+(filter (\ {x} {1}) {(/ 1 0) 2})
+(elem 3 {(/ 1 0) 2})
+(pmap (\ {x} {1}) {(/ 1 0) 2})
+(check "elem stops at the item found" (elem 2 {2 (/ 1 0)}) 1)
+;;; and gives the errors the prelude's nth, last, take and drop gave
+;;; running off the end of a list
+(nth 5 {1 2})
+(nth 2 {1 2})
+(last {})
+(take 3 {1 2})
+(drop 3 {1 2})
+
+;;; A symbol in an unknown package stops a load like a syntax error
+(def {after-unknown} 0)
+(load "tests/unknown-package.lsp")
+(check "load stops at an unknown package" after-unknown 0)
+
+;;; The root package can be named, though its name starts with ':'
+(def {x} "root")
+(load "tests/root-package.lsp")
+(check "root package by name" rootpk:root-x "root")
+(check "package keeps its own x" rootpk:own-x "own")
+(check "root x untouched" :LSPY:x "root")
+
+;;; The radix sort of numbers orders them as the comparison does
+(check "sort > keeps equal zeros in order"
+  (map number->string (sort > {-0.0 0.0})) {"-0.000000" "0.000000"})
+(check "sort keeps equal zeros in order"
+  (map number->string (sort {0.0 -1.0 -0.0})) {"-1.000000" "0.000000" "-0.000000"})
+(def {a} (string->number "9007199254740993"))
+(def {b} (string->number "9007199254740992"))
+(check "sort < compares integers past 2^53 as doubles"
+  (map number->string (sort < (list a b))) {"9007199254740993" "9007199254740992"})
+(check "natural sort compares integers exactly"
+  (map number->string (sort (list a b))) {"9007199254740992" "9007199254740993"})
+
+;;; ash stays in an integer while the result fits, on either sign
+(check "ash of a negative number"
+  (map number->string (list (ash -1 62) (ash -3 62) (ash 3 61) (ash 1 63) (ash -5 -1)))
+  {"-4611686018427387904" "-13835058055282163712" "6917529027641081856"
+   "9223372036854775808" "-3"})
+
+;;; Zero, or a shift further right than any bignum is wide, needs no range
+(check "ash of zero or far right"
+  (map number->string
+    (list (ash 0 1000) (ash (to-bnum 0) 1000) (ash -1 -1000)
+          (ash (string->number "123456789012345678901234567890") -1000)
+          (ash (string->number "-123456789012345678901234567890") -1000)))
+  {"0" "0" "-1" "0" "-1"})
+
+(print "done")
@@ -0,0 +1,8 @@
+;;; Loaded by regress.lsp. Code in another package that binds x of its
+;;; own still reaches the root's x by naming the root package
+(make-package "rootpk")
+(in-package "rootpk")
+(def {x} "own")
+(def {root-x} :LSPY:x)
+(def {own-x} x)
+(in-package ":LSPY")
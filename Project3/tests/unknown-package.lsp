@@ -0,0 +1,4 @@
+;;; Loaded by regress.lsp. The unknown package stops the load before
+;;; the def after it
+(print nosuchpackage:x)
+(def {after-unknown} 1)
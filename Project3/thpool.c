@@ -0,0 +1,246 @@
+// Portable threads and a shared worker pool.
+
+#include "thpool.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+void th_mutex_init(th_mutex* m) { InitializeCriticalSection(m); }
+void th_mutex_destroy(th_mutex* m) { DeleteCriticalSection(m); }
+void th_mutex_lock(th_mutex* m) { EnterCriticalSection(m); }
+void th_mutex_unlock(th_mutex* m) { LeaveCriticalSection(m); }
+void th_cond_init(th_cond* c) { InitializeConditionVariable(c); }
+void th_cond_destroy(th_cond* c) { (void)c; }
+void th_cond_wait(th_cond* c, th_mutex* m) { SleepConditionVariableCS(c, m, INFINITE); }
+void th_cond_signal(th_cond* c) { WakeConditionVariable(c); }
+void th_cond_broadcast(th_cond* c) { WakeAllConditionVariable(c); }
+void th_yield(void) { SwitchToThread(); }
+
+long th_atomic_add(volatile long* p, long v) {
+    return InterlockedExchangeAdd(p, v) + v;
+}
+
+int th_atomic_cas(volatile long* p, long old, long v) {
+    return InterlockedCompareExchange(p, v, old) == old;
+}
+
+int th_cpu_count(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
+#else
+
+void th_mutex_init(th_mutex* m) { pthread_mutex_init(m, NULL); }
+void th_mutex_destroy(th_mutex* m) { pthread_mutex_destroy(m); }
+void th_mutex_lock(th_mutex* m) { pthread_mutex_lock(m); }
+void th_mutex_unlock(th_mutex* m) { pthread_mutex_unlock(m); }
+void th_cond_init(th_cond* c) { pthread_cond_init(c, NULL); }
+void th_cond_destroy(th_cond* c) { pthread_cond_destroy(c); }
+void th_cond_wait(th_cond* c, th_mutex* m) { pthread_cond_wait(c, m); }
+void th_cond_signal(th_cond* c) { pthread_cond_signal(c); }
+void th_cond_broadcast(th_cond* c) { pthread_cond_broadcast(c); }
+void th_yield(void) { sched_yield(); }
+
+long th_atomic_add(volatile long* p, long v) {
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+int th_atomic_cas(volatile long* p, long old, long v) {
+    return __atomic_compare_exchange_n(p, &old, v, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+int th_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+#endif
+
+// Trampoline so both platforms can start a void (*)(void*).
+typedef struct {
+    void (*fn)(void*);
+    void* arg;
+} th_start;
+
+#ifdef _WIN32
+static unsigned __stdcall th_entry(void* p) {
+#else
+static void* th_entry(void* p) {
+#endif
+    th_start s = *(th_start*)p;
+    free(p);
+    s.fn(s.arg);
+    return 0;
+}
+
+int th_thread_create(th_thread* t, void (*fn)(void*), void* arg) {
+    th_start* s = malloc(sizeof(th_start));
+    if (s == NULL) {
+        return -1;
+    }
+    s->fn = fn;
+    s->arg = arg;
+#ifdef _WIN32
+    *t = (HANDLE)_beginthreadex(NULL, 0, th_entry, s, 0, NULL);
+    if (*t == 0) {
+        free(s);
+        return -1;
+    }
+#else
+    if (pthread_create(t, NULL, th_entry, s) != 0) {
+        free(s);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void th_thread_join(th_thread t) {
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
+
+void th_thread_detach(th_thread t) {
+#ifdef _WIN32
+    CloseHandle(t);
+#else
+    pthread_detach(t);
+#endif
+}
+
+// Shared pool: one job at a time, indexes handed out by an atomic counter.
+typedef struct {
+    th_mutex lock;
+    th_cond start;      // workers wait here for a new job
+    th_cond done;       // caller waits here for the job to drain
+    int nthreads;       // workers, not counting the caller
+    long generation;    // bumped for every job
+    int busy;           // a job is running
+    thpool_fn fn;
+    void* arg;
+    volatile long next; // next index to hand out
+    long n;             // indexes in the job
+    int active;         // workers still inside the job
+} thpool;
+
+static thpool pool;
+static volatile long pool_state = 0;    // 0 new, 1 starting, 2 ready
+
+#ifdef _WIN32
+static __declspec(thread) int in_worker = 0;
+#else
+static __thread int in_worker = 0;
+#endif
+
+static void thpool_drain(thpool_fn fn, void* arg, long n) {
+    long i;
+    while ((i = th_atomic_add(&pool.next, 1) - 1) < n) {
+        fn(arg, (int)i);
+    }
+}
+
+static void thpool_worker(void* unused) {
+    long seen = 0;
+    in_worker = 1;
+
+    th_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen) {
+            th_cond_wait(&pool.start, &pool.lock);
+        }
+        seen = pool.generation;
+        thpool_fn fn = pool.fn;
+        void* arg = pool.arg;
+        long n = pool.n;
+        pool.active++;
+        th_mutex_unlock(&pool.lock);
+
+        thpool_drain(fn, arg, n);
+
+        th_mutex_lock(&pool.lock);
+        if (--pool.active == 0) {
+            th_cond_signal(&pool.done);
+        }
+    }
+}
+
+static void thpool_start(void) {
+    if (pool_state == 2) {
+        return;
+    }
+    if (th_atomic_cas(&pool_state, 0, 1)) {
+        th_mutex_init(&pool.lock);
+        th_cond_init(&pool.start);
+        th_cond_init(&pool.done);
+        pool.nthreads = 0;
+        pool.generation = 0;
+        pool.busy = 0;
+        for (int i = 1; i < th_cpu_count(); i++) {
+            th_thread t;
+            if (th_thread_create(&t, thpool_worker, NULL) != 0) {
+                break;
+            }
+            pool.nthreads++;
+        }
+        th_atomic_add(&pool_state, 1);
+    }
+    while (th_atomic_add(&pool_state, 0) != 2) {
+        th_yield();
+    }
+}
+
+int thpool_size(void) {
+    thpool_start();
+    return pool.nthreads + 1;
+}
+
+void thpool_for(thpool_fn fn, void* arg, int n) {
+    thpool_start();
+
+    th_mutex_lock(&pool.lock);
+    if (in_worker || pool.busy || pool.nthreads == 0 || n < 2) {
+        th_mutex_unlock(&pool.lock);
+        for (int i = 0; i < n; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+    pool.busy = 1;
+
+    // Workers still leaving the previous job must not see this one's state.
+    while (pool.active > 0) {
+        th_cond_wait(&pool.done, &pool.lock);
+    }
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.n = n;
+    pool.next = 0;
+    pool.generation++;
+    th_cond_broadcast(&pool.start);
+    th_mutex_unlock(&pool.lock);
+
+    // The caller works on the job too.
+    thpool_drain(fn, arg, n);
+
+    th_mutex_lock(&pool.lock);
+    while (pool.active > 0) {
+        th_cond_wait(&pool.done, &pool.lock);
+    }
+    pool.busy = 0;
+    th_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,64 @@
+#pragma once
+// Portable threads and a shared worker pool.
+
+#ifndef _THPOOL_H
+#define _THPOOL_H
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION th_mutex;
+typedef CONDITION_VARIABLE th_cond;
+typedef HANDLE th_thread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t th_mutex;
+typedef pthread_cond_t th_cond;
+typedef pthread_t th_thread;
+#endif
+
+// Thin wrappers over the native primitives.
+void th_mutex_init(th_mutex* m);
+void th_mutex_destroy(th_mutex* m);
+void th_mutex_lock(th_mutex* m);
+void th_mutex_unlock(th_mutex* m);
+void th_cond_init(th_cond* c);
+void th_cond_destroy(th_cond* c);
+void th_cond_wait(th_cond* c, th_mutex* m);
+void th_cond_signal(th_cond* c);
+void th_cond_broadcast(th_cond* c);
+
+// Start fn(arg) on a new thread, return 0 on success.
+int th_thread_create(th_thread* t, void (*fn)(void*), void* arg);
+void th_thread_join(th_thread t);
+// Let a thread free itself when it ends, instead of being joined.
+void th_thread_detach(th_thread t);
+void th_yield(void);
+
+// Number of hardware threads.
+int th_cpu_count(void);
+
+// Atomic add on a shared counter, returns the new value.
+long th_atomic_add(volatile long* p, long v);
+
+// Set *p to v if it holds old, return non-zero if it did.
+int th_atomic_cas(volatile long* p, long old, long v);
+
+// Read a shared counter, seeing the writes made before it was last set.
+#ifdef _WIN32
+#define th_atomic_load(p) (*(volatile long*)(p))
+#else
+#define th_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+// Task run by thpool_for, i goes from 0 to n-1.
+typedef void (*thpool_fn)(void* arg, int i);
+
+// Number of threads thpool_for spreads work over, caller included.
+int thpool_size(void);
+
+// Run fn(arg, i) for every i in [0, n) on the shared pool and wait for
+// all of them. The pool is started on first use. Calls made while the
+// pool is busy, or from one of its workers, run inline on the caller.
+void thpool_for(thpool_fn fn, void* arg, int n);
+
+#endif // _THPOOL_H